@@ -0,0 +1,145 @@
+// Counts the heap allocations of the store during stage sessions (join, updates, leave) with and without the per-stage arena,
+// and of lookups by composite index keys.
+// The payloads are built up front, so only allocations made by the store are counted.
+// Usage: DigitalStage-bench-allocations [sessions] [tracks per session] [updates per track]
+#include <DigitalStage/Api/Store.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+  std::atomic<bool> counting {false};
+  std::atomic<std::size_t> allocations {0};
+  std::atomic<std::size_t> deallocations {0};
+}
+
+void* operator new(std::size_t size)
+{
+  if (counting.load(std::memory_order_relaxed)) {
+      allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (void* p = std::malloc(size == 0 ? 1 : size)) {
+      return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  if (p && counting.load(std::memory_order_relaxed)) {
+      deallocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  operator delete(p);
+}
+
+namespace {
+  nlohmann::json stageMember(const std::string& id)
+  {
+    return {{"_id", id}, {"stageId", "60bf3e0f6fb4d5a5a9c13b0a"}, {"userId", "60bf3e0f6fb4d5a5a9c13b0b"},
+            {"active", true}, {"isDirector", false}, {"groupId", "60bf3e0f6fb4d5a5a9c13b0c"}, {"volume", 1.0}};
+  }
+
+  nlohmann::json audioTrack(const std::string& id, const std::string& stageMemberId)
+  {
+    return {{"_id", id}, {"userId", "60bf3e0f6fb4d5a5a9c13b0b"}, {"deviceId", "60bf3e0f6fb4d5a5a9c13b0d"},
+            {"stageId", "60bf3e0f6fb4d5a5a9c13b0a"}, {"stageMemberId", stageMemberId},
+            {"stageDeviceId", "60bf3e0f6fb4d5a5a9c13b0e"}, {"type", "native"}, {"volume", 1.0}};
+  }
+
+  std::string objectId(std::size_t session, std::size_t index)
+  {
+    auto suffix = std::to_string(session * 100000 + index);
+    return std::string(24 - suffix.size(), '0') + suffix;
+  }
+
+  void run(bool useArena, std::size_t sessions, std::size_t tracks, std::size_t updates)
+  {
+    DigitalStage::Api::Store store;
+    allocations = 0;
+    deallocations = 0;
+    std::chrono::steady_clock::duration elapsed {};
+    for (std::size_t session = 0; session < sessions; ++session) {
+        std::vector<nlohmann::json> creates;
+        std::vector<nlohmann::json> patches;
+        for (std::size_t index = 0; index < tracks; ++index) {
+            creates.push_back(stageMember(objectId(session, index)));
+            creates.push_back(audioTrack(objectId(session, tracks + index), objectId(session, index)));
+            for (std::size_t update = 0; update < updates; ++update) {
+                patches.push_back({{"_id", objectId(session, tracks + index)}, {"volume", 1.0 / (update + 1)}});
+            }
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        counting = true;
+        if (useArena) {
+            store.beginStageArena();
+        }
+        auto transaction = store.transaction();
+        for (std::size_t index = 0; index < creates.size(); index += 2) {
+            transaction.stageMembers.create(creates[index]);
+            transaction.audioTracks.create(creates[index + 1]);
+        }
+        transaction.commit();
+        for (const auto& patch : patches) {
+            store.audioTracks.update(patch);
+        }
+        store.publish();
+        store.stageMembers.removeAll();
+        store.audioTracks.removeAll();
+        if (useArena) {
+            store.endStageArena();
+        }
+        store.publish();
+        counting = false;
+        elapsed += std::chrono::steady_clock::now() - start;
+    }
+    std::cout << (useArena ? "stage arena" : "heap       ")
+              << ": " << allocations.load() << " allocations, "
+              << deallocations.load() << " deallocations, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << " us" << std::endl;
+  }
+
+  void lookups(std::size_t count)
+  {
+    DigitalStage::Api::Store store;
+    const DigitalStage::Types::ID_TYPE groupId("60bf3e0f6fb4d5a5a9c13b0c");
+    const DigitalStage::Types::ID_TYPE targetGroupId("60bf3e0f6fb4d5a5a9c13b0f");
+    store.customGroups.create({{"_id", "60bf3e0f6fb4d5a5a9c13b10"}, {"groupId", groupId.str()}, {"targetGroupId", targetGroupId.str()},
+                               {"stageId", "60bf3e0f6fb4d5a5a9c13b0a"}, {"volume", 1.0}});
+    // Let the per thread key buffer grow before counting
+    store.getCustomGroupByGroupAndTargetGroup(groupId, targetGroupId);
+    allocations = 0;
+    std::size_t found = 0;
+    const auto start = std::chrono::steady_clock::now();
+    counting = true;
+    for (std::size_t index = 0; index < count; ++index) {
+        found += store.getCustomGroupByGroupAndTargetGroup(groupId, targetGroupId).has_value();
+    }
+    counting = false;
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "lookups    : " << found << " composite key lookups, " << allocations.load() << " allocations, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << " us" << std::endl;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t sessions = argc > 1 ? std::stoul(argv[1]) : 20;
+  const std::size_t tracks = argc > 2 ? std::stoul(argv[2]) : 200;
+  const std::size_t updates = argc > 3 ? std::stoul(argv[3]) : 10;
+  std::cout << sessions << " stage sessions with " << tracks << " members and tracks, " << updates << " updates per track" << std::endl;
+  run(false, sessions, tracks, updates);
+  run(true, sessions, tracks, updates);
+  lookups(sessions * tracks * updates);
+  return 0;
+}
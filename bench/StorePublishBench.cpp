@@ -0,0 +1,57 @@
+// Measures the cost of publishing a single change, depending on the number of entities inside the collection.
+// Each round patches one audio track and publishes the store, the payloads are built up front.
+// Usage: DigitalStage-bench-publish [rounds per size]
+#include <DigitalStage/Api/Store.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+  nlohmann::json audioTrack(const std::string& id)
+  {
+    return {{"_id", id}, {"userId", "60bf3e0f6fb4d5a5a9c13b0b"}, {"deviceId", "60bf3e0f6fb4d5a5a9c13b0d"},
+            {"stageId", "60bf3e0f6fb4d5a5a9c13b0a"}, {"stageMemberId", "60bf3e0f6fb4d5a5a9c13b0c"},
+            {"stageDeviceId", "60bf3e0f6fb4d5a5a9c13b0e"}, {"type", "native"}, {"volume", 1.0}};
+  }
+
+  std::string objectId(std::size_t index)
+  {
+    auto suffix = std::to_string(index);
+    return std::string(24 - suffix.size(), '0') + suffix;
+  }
+
+  void run(std::size_t size, std::size_t rounds)
+  {
+    DigitalStage::Api::Store store;
+    for (std::size_t index = 0; index < size; ++index) {
+        store.audioTracks.create(audioTrack(objectId(index)));
+    }
+    store.publish();
+
+    std::vector<nlohmann::json> patches;
+    patches.reserve(rounds);
+    for (std::size_t round = 0; round < rounds; ++round) {
+        patches.push_back({{"_id", objectId(round * 7919 % size)}, {"volume", 1.0 / (round + 1)}});
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& patch : patches) {
+        store.audioTracks.update(patch);
+        store.publish();
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << size << " entities: " << elapsed.count() / static_cast<long long>(rounds) / 1000.0 << " us per publish" << std::endl;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t rounds = argc > 1 ? std::stoul(argv[1]) : 2000;
+  std::cout << rounds << " rounds of one change and publish" << std::endl;
+  for (const std::size_t size : {100, 1000, 10000, 100000}) {
+      run(size, rounds);
+  }
+  return 0;
+}
@@ -0,0 +1,131 @@
+#ifndef DS_BOUNDED_QUEUE
+#define DS_BOUNDED_QUEUE
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace DigitalStage {
+  namespace Api {
+
+    /**
+     * Bounded lock-free queue for multiple producers and consumers, based on the ring buffer design of Dmitry Vyukov.
+     *
+     * Each cell carries a sequence number telling producers and consumers whether it is free or filled,
+     * so pushing and popping only costs a compare-and-swap on the shared position and never waits for a lock.
+     * The capacity is rounded up to the next power of two.
+     */
+    template <typename T>
+    class BoundedQueue {
+    public:
+      explicit BoundedQueue(std::size_t capacity) : capacity_(roundUp(capacity)), mask_(capacity_ - 1), cells_(new Cell[capacity_])
+      {
+        for (std::size_t i = 0; i < capacity_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+      }
+
+      BoundedQueue(const BoundedQueue&) = delete;
+      BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+      /**
+       * Appends the value, if the queue is not full
+       * @return false if the queue is full, the value is left untouched then
+       */
+      bool tryPush(T&& value)
+      {
+        std::size_t position = enqueuePosition_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[position & mask_];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if (difference == 0) {
+                if (enqueuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = enqueuePosition_.load(std::memory_order_relaxed);
+            }
+        }
+      }
+
+      /**
+       * Removes the oldest value, if the queue is not empty
+       * @return false if the queue is empty
+       */
+      bool tryPop(T& value)
+      {
+        std::size_t position = dequeuePosition_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[position & mask_];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+            if (difference == 0) {
+                if (dequeuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = dequeuePosition_.load(std::memory_order_relaxed);
+            }
+        }
+      }
+
+      /**
+       * Returns the number of queued values, which may already be outdated when used concurrently
+       */
+      std::size_t size() const noexcept
+      {
+        const std::size_t dequeued = dequeuePosition_.load(std::memory_order_acquire);
+        const std::size_t enqueued = enqueuePosition_.load(std::memory_order_acquire);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+      }
+
+      bool empty() const noexcept
+      {
+        return size() == 0;
+      }
+
+      std::size_t capacity() const noexcept
+      {
+        return capacity_;
+      }
+
+    private:
+      struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+      };
+
+      static std::size_t roundUp(std::size_t capacity)
+      {
+        std::size_t result = 2;
+        while (result < capacity) {
+            result <<= 1;
+        }
+        return result;
+      }
+
+      const std::size_t capacity_;
+      const std::size_t mask_;
+      std::unique_ptr<Cell[]> cells_;
+      // Producers and consumers work on separate cache lines
+      alignas(64) std::atomic<std::size_t> enqueuePosition_{0};
+      alignas(64) std::atomic<std::size_t> dequeuePosition_{0};
+    };
+  } // namespace Api
+} // namespace DigitalStage
+
+#endif // DS_BOUNDED_QUEUE
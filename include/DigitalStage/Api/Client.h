@@ -1,8 +1,11 @@
 #ifndef DS_CLIENT
 #define DS_CLIENT
 
+#include "EventDispatcher.h"
 #include "Events.h"
+#include "SendBatcher.h"
 #include "Store.h"
+#include <functional>
 #include <future>
 #include <mutex>
 #include <optional>
@@ -33,6 +36,22 @@ namespace DigitalStage {
 
             void connect(const std::string& apiToken, const nlohmann::json& initialDevicePayload = nullptr);
 
+            /**
+             * Handles all received events on a dedicated dispatcher thread instead of the network thread,
+             * so slow signal slots do not stall the connection.
+             * All signals are emitted on the dispatcher thread then.
+             * Call this before connect().
+             * Bursts of changes to the same entity can be merged by setting options.coalesce to RetrieveEvents::changeEvents().
+             * @param options queue capacity, what to do with events received while the queue is full and which events to coalesce
+             */
+            void enableDispatcher(EventDispatcher::Options options = {});
+
+            /**
+             * Returns the queue metrics of the dispatcher thread
+             * @return metrics or nullopt, if the dispatcher is not enabled
+             */
+            std::optional<EventDispatcher::Metrics> getDispatcherMetrics() const;
+
             void disconnect();
 
             std::weak_ptr<Store> getStore() const;
@@ -43,76 +62,107 @@ namespace DigitalStage {
 
             void send(const std::string& event, const nlohmann::json& message, teckos::Callback callback) noexcept(false);
 
+            /**
+             * Collects all messages sent until commit() and sends them at once,
+             * consecutive changes to the same entity (see SendEvents::changeEvents()) are merged into a single message.
+             * Batches may be nested, each call has to be followed by a call to commit().
+             * The callback of each message is still called, merged messages share the result.
+             */
+            void beginBatch();
+
+            /**
+             * Sends the messages collected since beginBatch(), once the outermost batch has been committed
+             */
+            void commit();
+
+            /**
+             * Collects the messages sent within the window and sends them at once, like beginBatch() and commit() do
+             * @param window time to collect messages for, zero sends each message right away (default)
+             */
+            void setSendBatchWindow(std::chrono::milliseconds window);
+
+            /**
+             * Returns queue depth and send latency of the outgoing messages.
+             * WebRTC signaling messages (see SendEvents::signalingEvents()) use the priority lane
+             * and overtake queued bulk messages.
+             */
+            SendBatcher::Metrics getSendMetrics() const;
+
+            /*
+             * All signals pass entities, patches and the store by const reference, so no slot causes a copy.
+             * The references are only valid during the slot, copy what has to be kept afterwards.
+             * Values, which are only needed by a signal and not by the store, are only parsed while a slot is connected.
+             */
             sigslot::signal<bool /* expected */> disconnected;
-            sigslot::signal<std::weak_ptr<DigitalStage::Api::Store>> ready;
-            sigslot::signal<const Device, std::weak_ptr<DigitalStage::Api::Store>> localDeviceReady;
-            sigslot::signal<const User, std::weak_ptr<DigitalStage::Api::Store>> localUserReady;
+            sigslot::signal<const std::weak_ptr<DigitalStage::Api::Store>&> ready;
+            sigslot::signal<const Device&, const std::weak_ptr<DigitalStage::Api::Store>&> localDeviceReady;
+            sigslot::signal<const User&, const std::weak_ptr<DigitalStage::Api::Store>&> localUserReady;
 
-            sigslot::signal<const ID_TYPE&, const std::optional<ID_TYPE>&, std::weak_ptr<DigitalStage::Api::Store>> stageJoined;
-            sigslot::signal<std::weak_ptr<DigitalStage::Api::Store>> stageLeft;
+            sigslot::signal<const ID_TYPE&, const std::optional<ID_TYPE>&, const std::weak_ptr<DigitalStage::Api::Store>&> stageJoined;
+            sigslot::signal<const std::weak_ptr<DigitalStage::Api::Store>&> stageLeft;
 
-            sigslot::signal<const Device, std::weak_ptr<DigitalStage::Api::Store>> deviceAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> deviceChanged;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> localDeviceChanged;
+            sigslot::signal<const Device&, const std::weak_ptr<DigitalStage::Api::Store>&> deviceAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> deviceChanged;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> localDeviceChanged;
             /**
              * This will send when the audio driver has been changed.
              * The first parameter contains the new audio driver as optional value
              */
-            sigslot::signal<std::optional<std::string>, std::weak_ptr<DigitalStage::Api::Store>> audioDriverSelected;
+            sigslot::signal<const std::optional<std::string>&, const std::weak_ptr<DigitalStage::Api::Store>&> audioDriverSelected;
             /**
              * This will send when another input sound card has been selected.
              * First parameter is the ID of the sound card as optional value
              */
-            sigslot::signal<const std::optional<ID_TYPE>&, std::weak_ptr<DigitalStage::Api::Store>> inputSoundCardSelected;
+            sigslot::signal<const std::optional<ID_TYPE>&, const std::weak_ptr<DigitalStage::Api::Store>&> inputSoundCardSelected;
             /**
              * This will send when another output sound card has been selected.
              * First parameter is the ID of the sound card as optional value
              */
-            sigslot::signal<const std::optional<ID_TYPE>&, std::weak_ptr<DigitalStage::Api::Store>> outputSoundCardSelected;
-            sigslot::signal<const ID_TYPE&, std::weak_ptr<DigitalStage::Api::Store>> deviceRemoved;
+            sigslot::signal<const std::optional<ID_TYPE>&, const std::weak_ptr<DigitalStage::Api::Store>&> outputSoundCardSelected;
+            sigslot::signal<const ID_TYPE&, const std::weak_ptr<DigitalStage::Api::Store>&> deviceRemoved;
 
-            sigslot::signal<const Stage, std::weak_ptr<DigitalStage::Api::Store>> stageAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> stageChanged;
-            sigslot::signal<const ID_TYPE&, std::weak_ptr<DigitalStage::Api::Store>> stageRemoved;
+            sigslot::signal<const Stage&, const std::weak_ptr<DigitalStage::Api::Store>&> stageAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> stageChanged;
+            sigslot::signal<const ID_TYPE&, const std::weak_ptr<DigitalStage::Api::Store>&> stageRemoved;
 
-            sigslot::signal<const Group, std::weak_ptr<DigitalStage::Api::Store>> groupAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> groupChanged;
-            sigslot::signal<const ID_TYPE&, std::weak_ptr<DigitalStage::Api::Store>> groupRemoved;
+            sigslot::signal<const Group&, const std::weak_ptr<DigitalStage::Api::Store>&> groupAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> groupChanged;
+            sigslot::signal<const ID_TYPE&, const std::weak_ptr<DigitalStage::Api::Store>&> groupRemoved;
 
-            sigslot::signal<const CustomGroup, std::weak_ptr<DigitalStage::Api::Store>> customGroupAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> customGroupChanged;
-            sigslot::signal<const CustomGroup, std::weak_ptr<DigitalStage::Api::Store>> customGroupRemoved;
+            sigslot::signal<const CustomGroup&, const std::weak_ptr<DigitalStage::Api::Store>&> customGroupAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> customGroupChanged;
+            sigslot::signal<const CustomGroup&, const std::weak_ptr<DigitalStage::Api::Store>&> customGroupRemoved;
 
-            sigslot::signal<const StageMember, std::weak_ptr<DigitalStage::Api::Store>> stageMemberAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> stageMemberChanged;
-            sigslot::signal<const ID_TYPE&, std::weak_ptr<DigitalStage::Api::Store>> stageMemberRemoved;
+            sigslot::signal<const StageMember&, const std::weak_ptr<DigitalStage::Api::Store>&> stageMemberAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> stageMemberChanged;
+            sigslot::signal<const ID_TYPE&, const std::weak_ptr<DigitalStage::Api::Store>&> stageMemberRemoved;
 
-            sigslot::signal<const StageDevice, std::weak_ptr<DigitalStage::Api::Store>> stageDeviceAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> stageDeviceChanged;
-            sigslot::signal<const StageDevice&, std::weak_ptr<DigitalStage::Api::Store>> stageDeviceRemoved;
+            sigslot::signal<const StageDevice&, const std::weak_ptr<DigitalStage::Api::Store>&> stageDeviceAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> stageDeviceChanged;
+            sigslot::signal<const StageDevice&, const std::weak_ptr<DigitalStage::Api::Store>&> stageDeviceRemoved;
 
-            sigslot::signal<const SoundCard, std::weak_ptr<DigitalStage::Api::Store>> soundCardAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> soundCardChanged;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> inputSoundCardChanged;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> outputSoundCardChanged;
-            sigslot::signal<const ID_TYPE&, std::weak_ptr<DigitalStage::Api::Store>> soundCardRemoved;
+            sigslot::signal<const SoundCard&, const std::weak_ptr<DigitalStage::Api::Store>&> soundCardAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> soundCardChanged;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> inputSoundCardChanged;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> outputSoundCardChanged;
+            sigslot::signal<const ID_TYPE&, const std::weak_ptr<DigitalStage::Api::Store>&> soundCardRemoved;
 
-            sigslot::signal<const VideoTrack, std::weak_ptr<DigitalStage::Api::Store>> videoTrackAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> videoTrackChanged;
-            sigslot::signal<const VideoTrack, std::weak_ptr<DigitalStage::Api::Store>> videoTrackRemoved;
+            sigslot::signal<const VideoTrack&, const std::weak_ptr<DigitalStage::Api::Store>&> videoTrackAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> videoTrackChanged;
+            sigslot::signal<const VideoTrack&, const std::weak_ptr<DigitalStage::Api::Store>&> videoTrackRemoved;
 
-            sigslot::signal<const AudioTrack, std::weak_ptr<DigitalStage::Api::Store>> audioTrackAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> audioTrackChanged;
-            sigslot::signal<const AudioTrack, std::weak_ptr<DigitalStage::Api::Store>> audioTrackRemoved;
+            sigslot::signal<const AudioTrack&, const std::weak_ptr<DigitalStage::Api::Store>&> audioTrackAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> audioTrackChanged;
+            sigslot::signal<const AudioTrack&, const std::weak_ptr<DigitalStage::Api::Store>&> audioTrackRemoved;
 
-            sigslot::signal<const User, std::weak_ptr<DigitalStage::Api::Store>> userAdded;
-            sigslot::signal<const ID_TYPE&, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store>> userChanged;
-            sigslot::signal<const ID_TYPE&, std::weak_ptr<DigitalStage::Api::Store>> userRemoved;
+            sigslot::signal<const User&, const std::weak_ptr<DigitalStage::Api::Store>&> userAdded;
+            sigslot::signal<const ID_TYPE&, const nlohmann::json&, const std::weak_ptr<DigitalStage::Api::Store>&> userChanged;
+            sigslot::signal<const ID_TYPE&, const std::weak_ptr<DigitalStage::Api::Store>&> userRemoved;
 
-            sigslot::signal<const P2PRestart, std::weak_ptr<DigitalStage::Api::Store>> p2pRestart;
-            sigslot::signal<const P2PAnswer, std::weak_ptr<DigitalStage::Api::Store>> p2pAnswer;
-            sigslot::signal<const P2POffer, std::weak_ptr<DigitalStage::Api::Store>> p2pOffer;
-            sigslot::signal<const IceCandidate, std::weak_ptr<DigitalStage::Api::Store>> iceCandidate;
+            sigslot::signal<const P2PRestart&, const std::weak_ptr<DigitalStage::Api::Store>&> p2pRestart;
+            sigslot::signal<const P2PAnswer&, const std::weak_ptr<DigitalStage::Api::Store>&> p2pAnswer;
+            sigslot::signal<const P2POffer&, const std::weak_ptr<DigitalStage::Api::Store>&> p2pOffer;
+            sigslot::signal<const IceCandidate&, const std::weak_ptr<DigitalStage::Api::Store>&> iceCandidate;
 
             sigslot::signal<const std::exception&> error;
 
@@ -137,12 +187,50 @@ namespace DigitalStage {
             std::future<bool> leaveStage();
 
             // Suboptimal to put this here, but it is tested directly
+            /**
+             * Applies the given event to the store, emits the related signals and publishes a new store snapshot afterwards.
+             */
             void handleMessage(const std::string& event, const nlohmann::json& payload);
 
+            using EventHandler = std::function<void(const std::string& event, const nlohmann::json& payload)>;
+
+            /**
+             * Registers the handler for an event, which is not handled by this library (yet).
+             * Handlers run on the thread receiving the messages, like all signals,
+             * and the store is published after each of them, so changes applied by the handler become visible.
+             * Register all handlers before calling connect().
+             * @param event name of the event
+             * @param handler called with the event name and payload of each message
+             * @throws std::invalid_argument if there is already a handler for the event
+             */
+            void registerHandler(const std::string& event, EventHandler handler);
+
         private:
+            /**
+             * Validates all entities of a STAGE_JOINED payload, then applies them inside one transaction
+             */
+            class StageJoined;
+
+            void registerBuiltinHandlers();
+            /**
+             * Handles the message and reports any failure using the error signal
+             */
+            void dispatch(const std::string& event, const nlohmann::json& payload) noexcept;
+            void handleEvent(const std::string& event, const nlohmann::json& payload);
+
             const std::string apiUrl_;
             std::shared_ptr<Store> store_;
+            /**
+             * Passed to all signals, so emitting does not create a new weak pointer each time
+             */
+            std::weak_ptr<Store> weakStore_;
             std::unique_ptr<teckos::client> wsclient_;
+            std::unique_ptr<SendBatcher> batcher_;
+            /**
+             * Handler of each known event, so dispatching a message costs a single lookup
+             */
+            FlatMap<EventHandler> handlers_;
+            std::unique_ptr<EventDispatcher> dispatcher_;
         };
     } // namespace Api
 } // namespace DigitalStage
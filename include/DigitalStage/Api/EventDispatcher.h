@@ -0,0 +1,168 @@
+#ifndef DS_EVENT_DISPATCHER
+#define DS_EVENT_DISPATCHER
+
+#include "BoundedQueue.h"
+#include "FlatMap.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace DigitalStage {
+  namespace Api {
+
+    /**
+     * Hands received events over to a dedicated thread, which runs the handler for each of them in order.
+     *
+     * The receiving thread only appends to a bounded lock-free queue,
+     * so slow signal slots (UI, mixer) do not stall reading from the socket.
+     * This class is thread-safe.
+     */
+    class EventDispatcher {
+    public:
+      using Handler = std::function<void(const std::string& event, const nlohmann::json& payload)>;
+
+      /**
+       * Defines what happens to an event received while the queue is full
+       */
+      enum class OverflowPolicy {
+        /**
+         * Waits until the dispatcher thread made room, no event is lost but the receiving thread is stalled
+         */
+        Block,
+        /**
+         * Drops the received event
+         */
+        DropNewest,
+        /**
+         * Drops the oldest queued event to make room for the received one
+         */
+        DropOldest
+      };
+
+      struct Options {
+        std::size_t capacity = 1024;
+        OverflowPolicy overflow = OverflowPolicy::Block;
+        /**
+         * Differential events, whose consecutive patches to the same entity (by _id) are merged into one.
+         * Merged patches are delivered before any other event, once the queue drained or the window elapsed.
+         */
+        std::set<std::string> coalesce;
+        /**
+         * How long patches are held back to merge them at most, zero delivers them as soon as the queue drained
+         */
+        std::chrono::milliseconds coalesceWindow{0};
+      };
+
+      struct Metrics {
+        /**
+         * Number of queued events right now
+         */
+        std::size_t depth = 0;
+        /**
+         * Highest number of queued events so far
+         */
+        std::size_t peakDepth = 0;
+        std::uint64_t dispatched = 0;
+        std::uint64_t dropped = 0;
+        /**
+         * Number of events merged into a previous event of the same entity
+         */
+        std::uint64_t coalesced = 0;
+        /**
+         * Time the last dispatched event has been waiting inside the queue
+         */
+        std::chrono::microseconds lastWait{0};
+        std::chrono::microseconds maxWait{0};
+        /**
+         * Sum of all waiting times, divide it by dispatched for the average
+         */
+        std::chrono::microseconds totalWait{0};
+      };
+
+      /**
+       * Starts the dispatcher thread
+       * @param handler called on the dispatcher thread for each event
+       * @param options queue capacity and overflow policy
+       */
+      EventDispatcher(Handler handler, Options options);
+
+      /**
+       * Stops the dispatcher thread, events still queued are discarded
+       */
+      ~EventDispatcher();
+
+      EventDispatcher(const EventDispatcher&) = delete;
+      EventDispatcher& operator=(const EventDispatcher&) = delete;
+
+      /**
+       * Queues the event for the dispatcher thread
+       * @return false if the event has been dropped
+       */
+      bool post(std::string event, nlohmann::json payload);
+
+      Metrics metrics() const;
+
+    private:
+      struct Message {
+        std::string event;
+        nlohmann::json payload;
+        std::chrono::steady_clock::time_point received;
+      };
+
+      void run();
+      void wakeUp();
+      /**
+       * Wakes up producers blocked on a full queue, after the dispatcher thread popped an event
+       */
+      void madeRoom();
+      void recordDepth();
+      /**
+       * Merges the message into a pending patch of the same entity
+       * @return false if the message can not be coalesced
+       */
+      bool coalesce(Message& message);
+      void flushPending();
+      void handle(Message& message);
+
+      const Handler handler_;
+      const OverflowPolicy overflow_;
+      const std::set<std::string> coalesce_;
+      const std::chrono::milliseconds coalesceWindow_;
+      BoundedQueue<Message> queue_;
+
+      // Only used by the dispatcher thread
+      std::vector<Message> pending_;
+      FlatMap<std::size_t> pendingIndex_;
+      std::chrono::steady_clock::time_point pendingSince_;
+
+      std::atomic<bool> running_{true};
+      std::mutex wake_mutex_;
+      std::condition_variable wake_;
+      std::atomic<std::uint64_t> popped_{0};
+      std::atomic<std::size_t> blocked_{0};
+      std::mutex room_mutex_;
+      std::condition_variable room_;
+
+      std::atomic<std::size_t> peakDepth_{0};
+      std::atomic<std::uint64_t> dispatched_{0};
+      std::atomic<std::uint64_t> dropped_{0};
+      std::atomic<std::uint64_t> coalesced_{0};
+      std::atomic<std::int64_t> lastWait_{0};
+      std::atomic<std::int64_t> maxWait_{0};
+      std::atomic<std::int64_t> totalWait_{0};
+
+      // Started last, after everything it uses has been initialized
+      std::thread thread_;
+    };
+  } // namespace Api
+} // namespace DigitalStage
+
+#endif // DS_EVENT_DISPATCHER
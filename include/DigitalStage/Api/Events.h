@@ -3,6 +3,7 @@
 
 #include <DigitalStage/Types.h>
 #include <nlohmann/json.hpp>
+#include <set>
 #include <string>
 
 namespace DigitalStage {
@@ -32,6 +33,16 @@ namespace DigitalStage {
       extern const std::string LEAVE_STAGE;
       extern const std::string LEAVE_STAGE_FOR_GOOD;
 
+      /**
+       * Returns all events carrying a differential patch of a single entity,
+       * these can be merged by the SendBatcher
+       */
+      std::set<std::string> changeEvents();
+
+      /**
+       * Returns all WebRTC signaling events, these overtake other messages in the SendBatcher
+       */
+      std::set<std::string> signalingEvents();
     } // namespace SendEvents
 
     namespace RetrieveEvents {
@@ -75,6 +86,12 @@ namespace DigitalStage {
       extern const std::string P2P_ANSWER_SENT;
       extern const std::string ICE_CANDIDATE_SENT;
       extern const std::string TURN_SERVERS_CHANGED;
+
+      /**
+       * Returns all events carrying a differential patch of a single entity,
+       * these can be coalesced by the EventDispatcher
+       */
+      std::set<std::string> changeEvents();
     } // namespace RetrieveEvents
   }   // namespace Api
 } // namespace DigitalStage
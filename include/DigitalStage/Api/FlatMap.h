@@ -0,0 +1,317 @@
+#ifndef DS_FLAT_MAP
+#define DS_FLAT_MAP
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace DigitalStage {
+  namespace Api {
+
+    /**
+     * Hashes std::string keys and std::string_view lookups the same way
+     */
+    struct TransparentStringHash {
+      std::size_t operator()(std::string_view key) const noexcept
+      {
+        return std::hash<std::string_view>{}(key);
+      }
+    };
+
+    /**
+     * Type used to look up keys, std::string keys are looked up by std::string_view
+     */
+    template <typename Key>
+    struct FlatMapLookup {
+      using type = const Key&;
+    };
+
+    template <>
+    struct FlatMapLookup<std::string> {
+      using type = std::string_view;
+    };
+
+    /**
+     * Open addressing hash map, by default with string keys.
+     *
+     * The entries are stored densely inside a vector, so iterating is a linear walk over contiguous memory.
+     * Lookups probe a separate table of small buckets (hash fragment + entry index) with linear probing,
+     * so a miss or hit usually touches a single cache line before comparing the key.
+     * For string keys all lookups accept std::string_view, so callers do not have to build a std::string.
+     *
+     * Erasing moves the last entry into the erased position, so iterators and references are invalidated by erase and insertion.
+     * This container is not thread-safe.
+     */
+    template <typename Value, typename Hash = TransparentStringHash, typename Key = std::string>
+    class FlatMap {
+    public:
+      using key_type = Key;
+      using lookup_type = typename FlatMapLookup<Key>::type;
+      using mapped_type = Value;
+      using value_type = std::pair<Key, Value>;
+      using iterator = typename std::vector<value_type>::iterator;
+      using const_iterator = typename std::vector<value_type>::const_iterator;
+
+      FlatMap() = default;
+
+      std::size_t size() const noexcept
+      {
+        return entries_.size();
+      }
+
+      bool empty() const noexcept
+      {
+        return entries_.empty();
+      }
+
+      iterator begin() noexcept
+      {
+        return entries_.begin();
+      }
+
+      iterator end() noexcept
+      {
+        return entries_.end();
+      }
+
+      const_iterator begin() const noexcept
+      {
+        return entries_.begin();
+      }
+
+      const_iterator end() const noexcept
+      {
+        return entries_.end();
+      }
+
+      void clear() noexcept
+      {
+        entries_.clear();
+        buckets_.clear();
+      }
+
+      /**
+       * Estimates the heap memory held by this map, excluding memory owned by the values themselves
+       * @return bytes allocated for entries, buckets and long keys
+       */
+      std::size_t memoryUsage() const noexcept
+      {
+        std::size_t bytes = entries_.capacity() * sizeof(value_type) + buckets_.capacity() * sizeof(Bucket);
+        if constexpr (std::is_same_v<Key, std::string>) {
+            const std::size_t inlineCapacity = std::string().capacity();
+            for (const auto& entry : entries_) {
+                if (entry.first.capacity() > inlineCapacity) {
+                    bytes += entry.first.capacity() + 1;
+                }
+            }
+        }
+        return bytes;
+      }
+
+      void reserve(std::size_t count)
+      {
+        entries_.reserve(count);
+        if (count * kMaxLoadDenominator > buckets_.size() * kMaxLoadNumerator) {
+            rehash(bucketCountFor(count));
+        }
+      }
+
+      iterator find(lookup_type key) noexcept
+      {
+        auto bucket = findBucket(key);
+        return bucket == kNotFound ? entries_.end() : entries_.begin() + buckets_[bucket].index;
+      }
+
+      const_iterator find(lookup_type key) const noexcept
+      {
+        auto bucket = findBucket(key);
+        return bucket == kNotFound ? entries_.end() : entries_.begin() + buckets_[bucket].index;
+      }
+
+      std::size_t count(lookup_type key) const noexcept
+      {
+        return findBucket(key) == kNotFound ? 0 : 1;
+      }
+
+      Value& at(lookup_type key)
+      {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("Key not found in FlatMap");
+        }
+        return it->second;
+      }
+
+      const Value& at(lookup_type key) const
+      {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("Key not found in FlatMap");
+        }
+        return it->second;
+      }
+
+      Value& operator[](lookup_type key)
+      {
+        return try_emplace(key).first->second;
+      }
+
+      /**
+       * Inserts the value, if the key is not present yet
+       * @return iterator to the entry with the given key and true, if it has been inserted
+       */
+      template <typename... Args>
+      std::pair<iterator, bool> try_emplace(lookup_type key, Args&&... args)
+      {
+        const auto hash = hashOf(key);
+        auto bucket = findBucket(key, hash);
+        if (bucket != kNotFound) {
+            return {entries_.begin() + buckets_[bucket].index, false};
+        }
+        if ((entries_.size() + 1) * kMaxLoadDenominator > buckets_.size() * kMaxLoadNumerator) {
+            rehash(bucketCountFor(entries_.size() + 1));
+        }
+        entries_.emplace_back(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        insertBucket(hash, static_cast<std::uint32_t>(entries_.size() - 1));
+        return {entries_.end() - 1, true};
+      }
+
+      template <typename V>
+      std::pair<iterator, bool> emplace(lookup_type key, V&& value)
+      {
+        return try_emplace(key, std::forward<V>(value));
+      }
+
+      std::size_t erase(lookup_type key)
+      {
+        auto bucket = findBucket(key);
+        if (bucket == kNotFound) {
+            return 0;
+        }
+        eraseBucket(bucket);
+        return 1;
+      }
+
+      iterator erase(const_iterator position)
+      {
+        const auto index = static_cast<std::size_t>(position - entries_.cbegin());
+        eraseBucket(findBucket(entries_[index].first));
+        return entries_.begin() + index;
+      }
+
+    private:
+      struct Bucket {
+        std::uint32_t hash;
+        std::uint32_t index;
+      };
+
+      static constexpr std::uint32_t kEmpty = UINT32_MAX;
+      static constexpr std::size_t kNotFound = SIZE_MAX;
+      static constexpr std::size_t kMaxLoadNumerator = 3;
+      static constexpr std::size_t kMaxLoadDenominator = 4;
+
+      static std::uint32_t hashOf(lookup_type key) noexcept
+      {
+        const auto hash = static_cast<std::uint64_t>(Hash{}(key));
+        // Fold the upper bits in, since the bucket is selected by the lower ones
+        return static_cast<std::uint32_t>(hash ^ (hash >> 32));
+      }
+
+      static std::size_t bucketCountFor(std::size_t count) noexcept
+      {
+        std::size_t buckets = 8;
+        while (count * kMaxLoadDenominator > buckets * kMaxLoadNumerator) {
+            buckets *= 2;
+        }
+        return buckets;
+      }
+
+      std::size_t findBucket(lookup_type key) const noexcept
+      {
+        return findBucket(key, hashOf(key));
+      }
+
+      std::size_t findBucket(lookup_type key, std::uint32_t hash) const noexcept
+      {
+        if (buckets_.empty()) {
+            return kNotFound;
+        }
+        const std::size_t mask = buckets_.size() - 1;
+        for (std::size_t bucket = hash & mask;; bucket = (bucket + 1) & mask) {
+            const auto& candidate = buckets_[bucket];
+            if (candidate.index == kEmpty) {
+                return kNotFound;
+            }
+            if (candidate.hash == hash && entries_[candidate.index].first == key) {
+                return bucket;
+            }
+        }
+      }
+
+      void insertBucket(std::uint32_t hash, std::uint32_t index) noexcept
+      {
+        const std::size_t mask = buckets_.size() - 1;
+        std::size_t bucket = hash & mask;
+        while (buckets_[bucket].index != kEmpty) {
+            bucket = (bucket + 1) & mask;
+        }
+        buckets_[bucket] = {hash, index};
+      }
+
+      void rehash(std::size_t bucketCount)
+      {
+        buckets_.assign(bucketCount, Bucket {0, kEmpty});
+        for (std::size_t index = 0; index < entries_.size(); ++index) {
+            insertBucket(hashOf(entries_[index].first), static_cast<std::uint32_t>(index));
+        }
+      }
+
+      void eraseBucket(std::size_t bucket)
+      {
+        const std::size_t mask = buckets_.size() - 1;
+        const std::uint32_t index = buckets_[bucket].index;
+
+        // Backward shift deletion, so no tombstones are needed:
+        // move every following bucket of the cluster into the hole, unless its home lies between the hole and itself
+        std::size_t hole = bucket;
+        for (std::size_t next = (hole + 1) & mask; buckets_[next].index != kEmpty; next = (next + 1) & mask) {
+            const std::size_t home = buckets_[next].hash & mask;
+            const bool reachable = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+            if (!reachable) {
+                buckets_[hole] = buckets_[next];
+                hole = next;
+            }
+        }
+        buckets_[hole].index = kEmpty;
+
+        // Keep the entries dense by moving the last one into the erased position
+        const std::uint32_t last = static_cast<std::uint32_t>(entries_.size() - 1);
+        if (index != last) {
+            entries_[index] = std::move(entries_[last]);
+            buckets_[findBucketOfIndex(entries_[index].first, last)].index = index;
+        }
+        entries_.pop_back();
+      }
+
+      std::size_t findBucketOfIndex(lookup_type key, std::uint32_t index) const noexcept
+      {
+        const std::size_t mask = buckets_.size() - 1;
+        std::size_t bucket = hashOf(key) & mask;
+        while (buckets_[bucket].index != index) {
+            bucket = (bucket + 1) & mask;
+        }
+        return bucket;
+      }
+
+      std::vector<value_type> entries_;
+      std::vector<Bucket> buckets_;
+    };
+  } // namespace Api
+} // namespace DigitalStage
+
+#endif // DS_FLAT_MAP
@@ -0,0 +1,380 @@
+#ifndef DS_PERSISTENT_MAP
+#define DS_PERSISTENT_MAP
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace DigitalStage {
+  namespace Api {
+
+    /**
+     * Immutable hash map, which shares all unchanged parts between its versions (hash array mapped trie).
+     *
+     * Copying the map is constant time, both copies share all nodes.
+     * set() and erase() only copy the nodes on the path to the changed entry, which are at most a handful,
+     * so deriving a new version from a large map costs the same as from a small one.
+     * Nodes are never modified after they have been built, so a version can be read by any number of threads,
+     * while another thread derives the next version from a copy.
+     * A single instance is not thread-safe.
+     */
+    template <typename Key, typename Value, typename Hash = std::hash<Key>>
+    class PersistentMap {
+      struct Node;
+      using NodePtr = std::shared_ptr<const Node>;
+
+      static constexpr unsigned kBits = 5;
+      static constexpr std::uint64_t kMask = (1u << kBits) - 1;
+      static constexpr unsigned kHashBits = 64;
+      /**
+       * Branches on the longest path, the leaf below them holds all entries with the very same hash
+       */
+      static constexpr std::size_t kMaxDepth = (kHashBits + kBits - 1) / kBits;
+
+    public:
+      using key_type = Key;
+      using mapped_type = Value;
+      using value_type = std::pair<Key, Value>;
+
+      class const_iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename PersistentMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        const_iterator() = default;
+
+        reference operator*() const
+        {
+          return top().node->entries[top().index];
+        }
+
+        pointer operator->() const
+        {
+          return &**this;
+        }
+
+        const_iterator& operator++()
+        {
+          ++top().index;
+          settle();
+          return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+          auto previous = *this;
+          ++*this;
+          return previous;
+        }
+
+        bool operator==(const const_iterator& other) const noexcept
+        {
+          if (depth_ == 0 || other.depth_ == 0) {
+              return depth_ == other.depth_;
+          }
+          return top().node == other.top().node && top().index == other.top().index;
+        }
+
+        bool operator!=(const const_iterator& other) const noexcept
+        {
+          return !(*this == other);
+        }
+
+      private:
+        friend class PersistentMap;
+
+        struct Frame {
+          const Node* node;
+          std::size_t index;
+        };
+
+        Frame& top() noexcept
+        {
+          return path_[depth_ - 1];
+        }
+
+        const Frame& top() const noexcept
+        {
+          return path_[depth_ - 1];
+        }
+
+        void push(const Node* node, std::size_t index) noexcept
+        {
+          path_[depth_++] = {node, index};
+        }
+
+        /**
+         * Moves forward to the next entry, starting at the current position
+         */
+        void settle() noexcept
+        {
+          while (depth_ > 0) {
+              auto& frame = top();
+              if (frame.node->leaf()) {
+                  if (frame.index < frame.node->entries.size()) {
+                      return;
+                  }
+              } else if (frame.index < frame.node->children.size()) {
+                  push(frame.node->children[frame.index].get(), 0);
+                  continue;
+              }
+              --depth_;
+              if (depth_ > 0) {
+                  ++top().index;
+              }
+          }
+        }
+
+        // A fixed path instead of a stack on the heap, so iterating never allocates
+        std::array<Frame, kMaxDepth + 1> path_ {};
+        std::size_t depth_ = 0;
+      };
+
+      PersistentMap() = default;
+
+      std::size_t size() const noexcept
+      {
+        return size_;
+      }
+
+      bool empty() const noexcept
+      {
+        return size_ == 0;
+      }
+
+      const_iterator begin() const noexcept
+      {
+        const_iterator it;
+        if (root_) {
+            it.push(root_.get(), 0);
+            it.settle();
+        }
+        return it;
+      }
+
+      const_iterator end() const noexcept
+      {
+        return const_iterator();
+      }
+
+      const_iterator find(const Key& key) const noexcept
+      {
+        const auto hash = hashOf(key);
+        const_iterator it;
+        unsigned shift = 0;
+        for (const Node* node = root_.get(); node; shift += kBits) {
+            if (node->leaf()) {
+                for (std::size_t index = 0; index < node->entries.size(); ++index) {
+                    if (node->entries[index].first == key) {
+                        it.push(node, index);
+                        return it;
+                    }
+                }
+                return end();
+            }
+            const auto bit = bitOf(hash, shift);
+            if ((node->bitmap & bit) == 0) {
+                return end();
+            }
+            const auto index = indexOf(node->bitmap, bit);
+            it.push(node, index);
+            node = node->children[index].get();
+        }
+        return end();
+      }
+
+      std::size_t count(const Key& key) const noexcept
+      {
+        return find(key) == end() ? 0 : 1;
+      }
+
+      const Value& at(const Key& key) const
+      {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("Key not found in PersistentMap");
+        }
+        return it->second;
+      }
+
+      /**
+       * Inserts the value or replaces the value stored for the key, copies of this map are not affected
+       */
+      void set(const Key& key, Value value)
+      {
+        bool added = false;
+        root_ = set(root_, hashOf(key), 0, key, std::move(value), added);
+        if (added) {
+            ++size_;
+        }
+      }
+
+      /**
+       * Removes the key, copies of this map are not affected
+       * @return number of removed entries
+       */
+      std::size_t erase(const Key& key)
+      {
+        bool erased = false;
+        root_ = erase(root_, hashOf(key), 0, key, erased);
+        if (!erased) {
+            return 0;
+        }
+        --size_;
+        return 1;
+      }
+
+      void clear() noexcept
+      {
+        root_.reset();
+        size_ = 0;
+      }
+
+    private:
+      /**
+       * Either a branch, which has a child for each bit set in bitmap,
+       * or a leaf (empty bitmap), which holds a single entry or, at the bottom, all entries sharing a hash
+       */
+      struct Node {
+        std::uint32_t bitmap = 0;
+        std::vector<NodePtr> children;
+        std::vector<value_type> entries;
+
+        bool leaf() const noexcept
+        {
+          return bitmap == 0;
+        }
+      };
+
+      static std::uint64_t hashOf(const Key& key) noexcept
+      {
+        // Spread the bits, since each level of the trie only looks at a few of them
+        auto hash = static_cast<std::uint64_t>(Hash{}(key));
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+        return hash;
+      }
+
+      static std::uint32_t bitOf(std::uint64_t hash, unsigned shift) noexcept
+      {
+        return std::uint32_t(1) << ((hash >> shift) & kMask);
+      }
+
+      /**
+       * Position of the child for the given bit, which is the number of children before it
+       */
+      static std::size_t indexOf(std::uint32_t bitmap, std::uint32_t bit) noexcept
+      {
+        std::uint32_t bits = bitmap & (bit - 1);
+        bits = bits - ((bits >> 1) & 0x55555555u);
+        bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+        return (((bits + (bits >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+      }
+
+      static NodePtr set(const NodePtr& node, std::uint64_t hash, unsigned shift, const Key& key, Value&& value, bool& added)
+      {
+        if (!node) {
+            auto leaf = std::make_shared<Node>();
+            leaf->entries.emplace_back(key, std::move(value));
+            added = true;
+            return leaf;
+        }
+        if (node->leaf()) {
+            for (std::size_t index = 0; index < node->entries.size(); ++index) {
+                if (node->entries[index].first == key) {
+                    auto copy = std::make_shared<Node>(*node);
+                    copy->entries[index].second = std::move(value);
+                    return copy;
+                }
+            }
+            if (shift >= kHashBits) {
+                auto copy = std::make_shared<Node>(*node);
+                copy->entries.emplace_back(key, std::move(value));
+                added = true;
+                return copy;
+            }
+            // All entries of a leaf share their hash, so the leaf moves one level down as a whole
+            auto branch = std::make_shared<Node>();
+            branch->bitmap = bitOf(hashOf(node->entries.front().first), shift);
+            branch->children.push_back(node);
+            return set(branch, hash, shift, key, std::move(value), added);
+        }
+        const auto bit = bitOf(hash, shift);
+        const auto index = indexOf(node->bitmap, bit);
+        auto copy = std::make_shared<Node>(*node);
+        if (node->bitmap & bit) {
+            copy->children[index] = set(node->children[index], hash, shift + kBits, key, std::move(value), added);
+        } else {
+            copy->bitmap |= bit;
+            copy->children.insert(copy->children.begin() + static_cast<std::ptrdiff_t>(index), set(nullptr, hash, shift + kBits, key, std::move(value), added));
+        }
+        return copy;
+      }
+
+      static NodePtr erase(const NodePtr& node, std::uint64_t hash, unsigned shift, const Key& key, bool& erased)
+      {
+        if (!node) {
+            return node;
+        }
+        if (node->leaf()) {
+            for (std::size_t index = 0; index < node->entries.size(); ++index) {
+                if (node->entries[index].first == key) {
+                    erased = true;
+                    if (node->entries.size() == 1) {
+                        return nullptr;
+                    }
+                    auto copy = std::make_shared<Node>(*node);
+                    copy->entries.erase(copy->entries.begin() + static_cast<std::ptrdiff_t>(index));
+                    return copy;
+                }
+            }
+            return node;
+        }
+        const auto bit = bitOf(hash, shift);
+        if ((node->bitmap & bit) == 0) {
+            return node;
+        }
+        const auto index = indexOf(node->bitmap, bit);
+        auto child = erase(node->children[index], hash, shift + kBits, key, erased);
+        if (!erased) {
+            return node;
+        }
+        // Branches left with a single leaf are replaced by that leaf, so lookups do not walk down lonely paths
+        if (child) {
+            if (child->leaf() && node->children.size() == 1) {
+                return child;
+            }
+            auto copy = std::make_shared<Node>(*node);
+            copy->children[index] = std::move(child);
+            return copy;
+        }
+        if (node->children.size() == 1) {
+            return nullptr;
+        }
+        if (node->children.size() == 2 && node->children[1 - index]->leaf()) {
+            return node->children[1 - index];
+        }
+        auto copy = std::make_shared<Node>(*node);
+        copy->bitmap &= ~bit;
+        copy->children.erase(copy->children.begin() + static_cast<std::ptrdiff_t>(index));
+        return copy;
+      }
+
+      NodePtr root_;
+      std::size_t size_ = 0;
+    };
+  } // namespace Api
+} // namespace DigitalStage
+
+#endif // DS_PERSISTENT_MAP
@@ -0,0 +1,178 @@
+#ifndef DS_SEND_BATCHER
+#define DS_SEND_BATCHER
+
+#include "FlatMap.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace DigitalStage {
+  namespace Api {
+
+    /**
+     * Collects outgoing messages into batches and merges consecutive patches to the same entity (by _id) into a single message.
+     *
+     * A batch is either opened explicitly with begin() and commit(), or spans all messages sent within a short window.
+     * Without both, messages are passed on right away.
+     * The callback of each message is still called, merged messages share the result of the message sent in their place.
+     *
+     * Priority events (e.g. WebRTC signaling) use a lane of their own: they are never batched
+     * and overtake bulk messages, which are collected or still being sent by another thread.
+     * This class is thread-safe.
+     */
+    class SendBatcher {
+    public:
+      using Callback = std::function<void(const std::vector<nlohmann::json>& result)>;
+      using Sender = std::function<void(const std::string& event, const nlohmann::json& payload, Callback callback)>;
+
+      struct LaneMetrics {
+        /**
+         * Number of messages waiting right now
+         */
+        std::size_t depth = 0;
+        /**
+         * Highest number of waiting messages so far
+         */
+        std::size_t peakDepth = 0;
+        std::uint64_t sent = 0;
+        /**
+         * Time between sending the last message and passing it on to the sender
+         */
+        std::chrono::microseconds lastLatency{0};
+        std::chrono::microseconds maxLatency{0};
+        /**
+         * Sum of all latencies, divide it by sent for the average
+         */
+        std::chrono::microseconds totalLatency{0};
+      };
+
+      struct Metrics {
+        LaneMetrics priority;
+        LaneMetrics bulk;
+      };
+
+      /**
+       * @param sender called for each message leaving the batcher
+       * @param merge events carrying a differential patch of a single entity, which may be merged
+       * @param priority events, which overtake all other messages
+       */
+      SendBatcher(Sender sender, std::set<std::string> merge, std::set<std::string> priority = {});
+
+      /**
+       * Stops the window thread, messages still pending are sent
+       */
+      ~SendBatcher();
+
+      SendBatcher(const SendBatcher&) = delete;
+      SendBatcher& operator=(const SendBatcher&) = delete;
+
+      /**
+       * Sets the time messages are collected before they are sent, zero disables the window
+       */
+      void setWindow(std::chrono::milliseconds window);
+
+      /**
+       * Opens a batch, batches may be nested
+       */
+      void begin();
+
+      /**
+       * Closes a batch and sends all collected messages once the outermost batch has been closed
+       */
+      void commit();
+
+      void send(const std::string& event, const nlohmann::json& payload, Callback callback);
+
+      /**
+       * Sends all collected messages right away
+       */
+      void flush();
+
+      /**
+       * Returns the number of messages, which have been merged into a previous one
+       */
+      std::uint64_t merged() const;
+
+      Metrics metrics() const;
+
+    private:
+      struct Message {
+        std::string event;
+        nlohmann::json payload;
+        std::vector<Callback> callbacks;
+        std::chrono::steady_clock::time_point queued;
+      };
+
+      /**
+       * Holds send_mutex_ and sends the priority messages queued meanwhile after releasing it
+       */
+      class Sending;
+
+      void run();
+      std::vector<Message> takePending();
+      /**
+       * Passes the collected messages to the sender, call this while holding send_mutex_ only
+       */
+      void sendAll(std::vector<Message> messages);
+      /**
+       * Sends the queued priority messages, unless another thread is sending.
+       * That thread sends them before its next message or right after it has finished.
+       */
+      void sendPriority();
+      /**
+       * Passes the queued priority messages to the sender, call this while holding send_mutex_ only
+       */
+      void sendQueuedPriority();
+      void sendMessage(Message& message, LaneMetrics& lane);
+      /**
+       * Records the latency of a message passed to the sender, call this without holding mutex_
+       */
+      void recordSent(LaneMetrics& lane, std::chrono::steady_clock::time_point queued);
+      static void recordDepth(LaneMetrics& lane, std::size_t depth);
+
+      const Sender sender_;
+      const std::set<std::string> merge_;
+      const std::set<std::string> priority_;
+
+      /**
+       * Keeps the order of messages sent by different threads, taken before mutex_.
+       * Recursive, since a sender may call back synchronously and send again.
+       */
+      std::recursive_mutex send_mutex_;
+      /**
+       * Number of times send_mutex_ is held, so a failed try_lock can tell a sending thread from a spurious failure
+       */
+      std::atomic<std::size_t> senders_{0};
+      mutable std::mutex mutex_;
+      std::condition_variable wake_;
+      std::vector<Message> pending_;
+      /**
+       * Position of the pending message of each event and entity, which following patches are merged into
+       */
+      FlatMap<std::size_t> pendingIndex_;
+      std::chrono::steady_clock::time_point pendingSince_;
+      /**
+       * Bulk messages taken from pending_, which have not been passed to the sender yet
+       */
+      std::size_t inFlight_ = 0;
+      std::deque<Message> prioritized_;
+      std::chrono::milliseconds window_{0};
+      int depth_ = 0;
+      bool running_ = true;
+      std::uint64_t merged_ = 0;
+      Metrics metrics_;
+      std::thread thread_;
+    };
+  } // namespace Api
+} // namespace DigitalStage
+
+#endif // DS_SEND_BATCHER
@@ -0,0 +1,82 @@
+#ifndef DS_STAGE_ARENA
+#define DS_STAGE_ARENA
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace DigitalStage {
+  namespace Api {
+
+    /**
+     * Memory arena for the entities of a single stage session.
+     *
+     * Memory is taken in large chunks from a monotonic buffer and handed out by a pool,
+     * so entities replaced by updates are recycled within the arena instead of returned to the heap.
+     * All chunks are released at once, when the arena is destroyed.
+     * Since each entity allocated from the arena keeps it alive, the arena may outlive the session, e.g. inside snapshots.
+     */
+    class StageArena {
+    public:
+      explicit StageArena(std::size_t initialSize = 64 * 1024) : buffer_(initialSize), pool_(&buffer_) {}
+
+      StageArena(const StageArena&) = delete;
+      StageArena& operator=(const StageArena&) = delete;
+
+      std::pmr::memory_resource* resource() noexcept
+      {
+        return &pool_;
+      }
+
+    private:
+      std::pmr::monotonic_buffer_resource buffer_;
+      std::pmr::synchronized_pool_resource pool_;
+    };
+
+    /**
+     * Allocator sharing the ownership of a stage arena, use it with std::allocate_shared
+     */
+    template <typename T>
+    class StageArenaAllocator {
+    public:
+      using value_type = T;
+
+      explicit StageArenaAllocator(std::shared_ptr<StageArena> arena) noexcept : arena_(std::move(arena)) {}
+
+      template <typename U>
+      StageArenaAllocator(const StageArenaAllocator<U>& other) noexcept : arena_(other.arena_)
+      {
+      }
+
+      T* allocate(std::size_t n)
+      {
+        return static_cast<T*>(arena_->resource()->allocate(n * sizeof(T), alignof(T)));
+      }
+
+      void deallocate(T* p, std::size_t n) noexcept
+      {
+        arena_->resource()->deallocate(p, n * sizeof(T), alignof(T));
+      }
+
+      template <typename U>
+      bool operator==(const StageArenaAllocator<U>& other) const noexcept
+      {
+        return arena_ == other.arena_;
+      }
+
+      template <typename U>
+      bool operator!=(const StageArenaAllocator<U>& other) const noexcept
+      {
+        return arena_ != other.arena_;
+      }
+
+    private:
+      template <typename U>
+      friend class StageArenaAllocator;
+
+      std::shared_ptr<StageArena> arena_;
+    };
+  } // namespace Api
+} // namespace DigitalStage
+
+#endif // DS_STAGE_ARENA
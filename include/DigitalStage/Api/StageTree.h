@@ -0,0 +1,159 @@
+#ifndef DS_STAGE_TREE
+#define DS_STAGE_TREE
+
+#include "DigitalStage/Types.h"
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <sigslot/signal.hpp>
+#include <tuple>
+#include <vector>
+
+namespace DigitalStage {
+  namespace Api {
+
+    /**
+     * Materialized hierarchy of the stage related entities:
+     * stage -> groups -> stage members -> stage devices -> audio and video tracks.
+     * Stage members without a group are children of their stage.
+     *
+     * The tree is owned and kept up to date by the Store, it is updated with the changes of each publish,
+     * so maintaining it only costs the number of changes.
+     * This class is thread-safe.
+     */
+    class StageTree {
+    public:
+      enum class Level { Stage, Group, StageMember, StageDevice, AudioTrack, VideoTrack };
+
+      /**
+       * Identifies a node of the tree.
+       * Handles are plain values, so they stay valid across updates and identify the same entity until it is removed.
+       */
+      struct Handle {
+        Level level;
+        Types::ID_TYPE id;
+
+        bool operator==(const Handle& other) const
+        {
+          return level == other.level && id == other.id;
+        }
+
+        bool operator!=(const Handle& other) const
+        {
+          return !(*this == other);
+        }
+
+        bool operator<(const Handle& other) const
+        {
+          return std::tie(level, id) < std::tie(other.level, other.id);
+        }
+      };
+
+      /**
+       * Returns all stages, which are the roots of the tree
+       * @return handles of all stages
+       */
+      std::vector<Handle> stages() const;
+
+      /**
+       * Returns the direct children of the given node
+       * @param node handle of the node
+       * @return handles of all children
+       */
+      std::vector<Handle> children(const Handle& node) const;
+
+      /**
+       * Returns the parent of the given node
+       * @param node handle of the node
+       * @return handle of the parent or nullopt, if the node is a stage or has not been found
+       */
+      std::optional<Handle> parent(const Handle& node) const;
+
+      /**
+       * Signals, if the entity of the given node is part of the tree
+       * @param node handle of the node
+       * @return true if the node exists
+       */
+      bool contains(const Handle& node) const;
+
+      /**
+       * Visits the given node and all of its descendants depth-first.
+       * The tree is read locked while visiting, so do not modify the store from inside the visitor.
+       * @param root handle of the first node to visit
+       * @param visitor called with the handle and depth (0 for root) of each node
+       */
+      template <typename Visitor>
+      void visit(const Handle& root, Visitor&& visitor) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto node = nodes_.find(root);
+        if (node != nodes_.end() && node->second.exists) {
+            visitLocked(*node, 0, visitor);
+        }
+      }
+
+      /**
+       * Emitted after each publish, which changed the tree.
+       * Contains the roots of all changed subtrees, so consumers only need to rebuild these.
+       * Removing a node marks its parent, only removed stages are reported by their own handle, use contains() to tell them apart.
+       */
+      sigslot::signal<const std::set<Handle>&> dirty;
+
+    private:
+      friend class Store;
+
+      struct Node {
+        std::optional<Handle> parent;
+        std::set<Handle> children;
+        /**
+         * False for placeholders of parents, which are not known (anymore) but still referenced by children
+         */
+        bool exists = false;
+      };
+
+      /**
+       * Inserts or moves the given node below the given parent
+       */
+      void set(const Handle& node, const std::optional<Handle>& parent);
+
+      /**
+       * Removes the given node, its children are kept until they are removed as well
+       */
+      void erase(const Handle& node);
+
+      /**
+       * Removes all nodes of the given level
+       */
+      void clear(Level level);
+
+      /**
+       * Emits dirty for all changes since the last call
+       */
+      void notify();
+
+      void eraseLocked(const Handle& node);
+      void detachLocked(const Handle& node, Node& entry);
+      void eraseIfUnusedLocked(const Handle& node);
+
+      template <typename Visitor>
+      void visitLocked(const std::pair<const Handle, Node>& node, std::size_t depth, Visitor& visitor) const
+      {
+        visitor(node.first, depth);
+        for (const auto& child : node.second.children) {
+            auto childNode = nodes_.find(child);
+            if (childNode != nodes_.end() && childNode->second.exists) {
+                visitLocked(*childNode, depth + 1, visitor);
+            }
+        }
+      }
+
+      mutable std::shared_mutex mutex_;
+      std::map<Handle, Node> nodes_;
+      std::set<Handle> dirty_;
+    };
+  } // namespace Api
+} // namespace DigitalStage
+
+#endif // DS_STAGE_TREE
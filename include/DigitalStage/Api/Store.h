@@ -1,15 +1,27 @@
-
 #ifndef DS_STORE
 #define DS_STORE
 
 #include "DigitalStage/Types.h"
+#include "DigitalStage/Api/FlatMap.h"
+#include "DigitalStage/Api/PersistentMap.h"
+#include "DigitalStage/Api/StageArena.h"
+#include "DigitalStage/Api/StageTree.h"
 #include <map>
 #include <mutex>
+#include <shared_mutex>
 #include <nlohmann/json.hpp>
 #include <set>
 #include <optional>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
 
+#include <sigslot/signal.hpp>
 #include <spdlog/spdlog.h>
 
 namespace DigitalStage {
@@ -17,93 +29,866 @@ namespace DigitalStage {
 
     using namespace nlohmann;
 
-    // This is a thread-safe container for our types, stored in json format in a map
+    /**
+     * Ids of the entities of a single collection, which have been added, changed or removed since the last publish.
+     * Multiple changes of the same entity are coalesced, e.g. an entity added and changed is only reported as added.
+     */
+    struct StoreChanges {
+      /**
+       * True if the collection has been cleared by removeAll().
+       * The removed entities are not listed then, added and changed are relative to the empty collection.
+       */
+      bool cleared = false;
+      std::set<Types::ID_TYPE> added;
+      std::set<Types::ID_TYPE> changed;
+      std::set<Types::ID_TYPE> removed;
+
+      bool empty() const
+      {
+        return !cleared && added.empty() && changed.empty() && removed.empty();
+      }
+
+      void recordCleared()
+      {
+        cleared = true;
+        added.clear();
+        changed.clear();
+        removed.clear();
+      }
+
+      void recordAdded(const Types::ID_TYPE& id)
+      {
+        if (removed.erase(id) > 0) {
+            // Replaced within the same batch
+            changed.insert(id);
+        }
+        else {
+            added.insert(id);
+        }
+      }
+
+      void recordChanged(const Types::ID_TYPE& id)
+      {
+        if (added.count(id) == 0) {
+            changed.insert(id);
+        }
+      }
+
+      void recordRemoved(const Types::ID_TYPE& id)
+      {
+        changed.erase(id);
+        if (added.erase(id) == 0) {
+            removed.insert(id);
+        }
+      }
+    };
+
+    /**
+     * Estimated memory usage of a single collection
+     */
+    struct CollectionMemoryUsage {
+      std::size_t entities = 0;
+      /**
+       * Highest number of entities this collection ever held
+       */
+      std::size_t peakEntities = 0;
+      /**
+       * Estimated bytes of the entities, their container, indexes and bookkeeping.
+       * Heap memory owned by string and vector fields of the entities is not included.
+       */
+      std::size_t bytes = 0;
+    };
+
+    // This is a thread-safe container for our types.
+    // Each entity is parsed once on create and kept as its typed struct, so reads do not touch any json.
+    // Entities are immutable once stored, changes replace them, so published snapshots can share them.
+    // Each published snapshot is derived from the previous one, so publishing only costs the number of changes.
     template <typename TYPE>
     class StoreEntry {
     public:
-      std::optional<TYPE> get(const Types::ID_TYPE& id) const noexcept
+      /**
+       * Immutable view of all entities of this collection at the time of the last publish().
+       * Consecutive snapshots share everything but the changed entries.
+       */
+      using Snapshot = PersistentMap<Types::ID_TYPE, std::shared_ptr<const TYPE>>;
+
+      StoreEntry() : published_(std::make_shared<const Snapshot>()) {}
+
+      /**
+       * Returns the last published version of this collection.
+       * This never waits for writers, the returned snapshot stays valid and unchanged as long as it is referenced.
+       * @return immutable snapshot
+       */
+      std::shared_ptr<const Snapshot> snapshot() const noexcept
       {
-        std::lock_guard<std::mutex> lock(mutex_store_);
-        if(storeEntry_.count(id) > 0) {
-            try {
-                return std::optional<TYPE>(storeEntry_.at(id).template get<const TYPE>());
+        return std::atomic_load(&published_);
+      }
+
+      /**
+       * Publishes the current state of this collection to snapshot readers, if it has been changed since the last publish.
+       * The next snapshot is derived from the previous one outside the collection lock, by applying only the changes,
+       * so publishing costs the number of changes, regardless of the size of the collection.
+       * @param changes receives the changes since the last publish
+       * @return the published snapshot
+       */
+      std::shared_ptr<const Snapshot> publish(StoreChanges& changes)
+      {
+        // Each publish builds on the snapshot of the one before
+        std::lock_guard<std::mutex> publishing(mutex_publish_);
+        std::vector<std::pair<Types::ID_TYPE, std::shared_ptr<const TYPE>>> stored;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_store_);
+            changes = std::move(pending_);
+            pending_ = StoreChanges();
+            if (!dirty_) {
+                return std::atomic_load(&published_);
+            }
+            dirty_ = false;
+            stored.reserve(changes.added.size() + changes.changed.size());
+            for (const auto* ids : {&changes.added, &changes.changed}) {
+                for (const auto& id : *ids) {
+                    auto it = storeEntry_.find(id);
+                    stored.emplace_back(id, it != storeEntry_.end() ? it->second : nullptr);
+                }
+            }
+        }
+
+        // After removeAll() the changes are relative to the empty collection
+        Snapshot next = changes.cleared ? Snapshot() : *std::atomic_load(&published_);
+        for (const auto& id : changes.removed) {
+            next.erase(id);
+        }
+        for (auto& item : stored) {
+            if (item.second) {
+                next.set(item.first, std::move(item.second));
+            } else {
+                next.erase(item.first);
+            }
+        }
+        auto published = std::make_shared<const Snapshot>(std::move(next));
+        std::atomic_store(&published_, published);
+        return published;
+      }
+
+      /**
+       * Collects operations, which are applied all at once by apply()
+       */
+      class Batch {
+      public:
+        explicit Batch(const StoreEntry& entry) : entry_(entry) {}
+
+        /**
+         * Parses the payload right away, so no parsing happens while the collection is locked
+         */
+        void create(const json& payload)
+        {
+          auto item = parse(payload);
+          if (item) {
+              create(std::move(*item));
+          }
+        }
+
+        /**
+         * Takes over an entity, which has already been parsed
+         * @return the entity as it will be stored, share it instead of copying
+         */
+        std::shared_ptr<const TYPE> create(TYPE&& item)
+        {
+          std::shared_ptr<const TYPE> entity = entry_.makeEntity(std::move(item));
+          operations_.push_back({Operation::Create, entity, nullptr, {}});
+          return entity;
+        }
+
+        /**
+         * Validates the id of the patch right away, an invalid one is logged and skipped instead of aborting the batch
+         */
+        void update(const json& payload)
+        {
+          auto id = parseId(payload);
+          if (id) {
+              operations_.push_back({Operation::Update, nullptr, payload, *id});
+          }
+        }
+
+        void remove(const Types::ID_TYPE& id)
+        {
+          operations_.push_back({Operation::Remove, nullptr, nullptr, id});
+        }
+
+        bool empty() const
+        {
+          return operations_.empty();
+        }
+
+      private:
+        friend class StoreEntry;
+        struct Operation {
+          enum Kind { Create, Update, Remove } kind;
+          std::shared_ptr<const TYPE> entity;
+          json payload;
+          Types::ID_TYPE id;
+        };
+        const StoreEntry& entry_;
+        std::vector<Operation> operations_;
+      };
+
+      /**
+       * Applies all operations of the given batch in order while holding the collection lock only once
+       * @param batch to apply, will be empty afterwards
+       */
+      void apply(Batch& batch)
+      {
+        if (batch.empty()) {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_store_);
+        for (auto& operation : batch.operations_) {
+            switch (operation.kind) {
+            case Batch::Operation::Create:
+                insertLocked(std::move(operation.entity));
+                break;
+            case Batch::Operation::Update:
+                updateLocked(operation.id, operation.payload);
+                break;
+            case Batch::Operation::Remove:
+                removeLocked(operation.id);
+                break;
             }
-            catch (Types::ParseException const &e) {
-                spdlog::error("Error in type conversion from json, returning nullopt: {}", e.what());
+        }
+        batch.operations_.clear();
+      }
+
+      /**
+       * Returns the key an entity is indexed by, or nullopt to leave the entity out of the index
+       */
+      using IndexKey = std::function<std::optional<std::string>(const TYPE&)>;
+
+      /**
+       * Adds a secondary index, which is kept up to date by create, update and remove.
+       * Existing entities are indexed immediately.
+       * @param name of the index, used by getAllBy
+       * @param key function returning the key of an entity
+       */
+      void addIndex(std::string_view name, IndexKey key)
+      {
+        std::unique_lock<std::shared_mutex> lock(mutex_store_);
+        auto& index = indexes_.try_emplace(std::string(name)).first->second;
+        index.key = std::move(key);
+        index.entries.clear();
+        for (const auto& item : storeEntry_) {
+            addToIndex(index, *item.second);
+        }
+      }
+
+      /**
+       * Returns all entities with the given key inside the given index.
+       * This only costs the size of the result.
+       * @param name of the index
+       * @param key to look up
+       * @return list of matching entities
+       */
+      std::vector<TYPE> getAllBy(std::string_view name, std::string_view key) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        std::vector<TYPE> items = std::vector<TYPE>();
+        auto index = indexes_.find(name);
+        if (index == indexes_.end()) {
+            spdlog::error("Cannot look up {}, index not found: {}", printableKey(key), name);
+            return items;
+        }
+        auto entry = index->second.entries.find(key);
+        if (entry != index->second.entries.end()) {
+            items.reserve(entry->second.size());
+            for (const auto& id : entry->second) {
+                items.push_back(*storeEntry_.at(id));
             }
         }
+        return items;
+      }
+
+      /**
+       * Same as getAllBy, for indexes keyed by an id
+       */
+      std::vector<TYPE> getAllBy(std::string_view name, const Types::ID_TYPE& key) const
+      {
+        return getAllBy(name, key.bytes());
+      }
+
+      /**
+       * Returns the entity with the given key inside the given index.
+       * Use this for unique indexes, if multiple entities share the key, the one with the lowest id is returned.
+       * @param name of the index
+       * @param key to look up
+       * @return matching entity or nullopt
+       */
+      std::optional<TYPE> getBy(std::string_view name, std::string_view key) const
+      {
+        auto item = getSharedBy(name, key);
+        if (item) {
+            return *item;
+        }
+        return std::nullopt;
+      }
+
+      /**
+       * Same as getBy, but returns the stored entity without copying it
+       */
+      std::shared_ptr<const TYPE> getSharedBy(std::string_view name, std::string_view key) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        auto index = indexes_.find(name);
+        if (index == indexes_.end()) {
+            spdlog::error("Cannot look up {}, index not found: {}", printableKey(key), name);
+            return nullptr;
+        }
+        auto entry = index->second.entries.find(key);
+        if (entry != index->second.entries.end() && !entry->second.empty()) {
+            return storeEntry_.at(*entry->second.begin());
+        }
+        return nullptr;
+      }
+
+      std::optional<TYPE> get(const Types::ID_TYPE& id) const noexcept
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        auto it = storeEntry_.find(id);
+        if (it != storeEntry_.end()) {
+            return *it->second;
+        }
         return std::nullopt;
       }
 
+      /**
+       * Returns the stored entity itself instead of a copy.
+       * Since stored entities are never modified, it stays valid and unchanged, even if the entity gets updated or removed meanwhile.
+       * This does not allocate, so it can be used inside hot paths.
+       * @param id of the entity
+       * @return the entity or nullptr
+       */
+      std::shared_ptr<const TYPE> getShared(const Types::ID_TYPE& id) const noexcept
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        auto it = storeEntry_.find(id);
+        if (it != storeEntry_.end()) {
+            return it->second;
+        }
+        return nullptr;
+      }
+
       std::vector<TYPE> getAll() const
       {
-        std::lock_guard<std::mutex> lock(mutex_store_);
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
         std::vector<TYPE> items = std::vector<TYPE>();
+        items.reserve(storeEntry_.size());
         for (const auto& item : storeEntry_) {
-            try {
-                items.push_back(item.second.template get<TYPE>());
+            items.push_back(*item.second);
+        }
+        return items;
+      }
+
+      /**
+       * Visits all entities by const reference without copying them.
+       * The collection is read locked while visiting, so do not modify it from inside the visitor.
+       * @param visitor called for each entity
+       */
+      template <typename Visitor>
+      void forEach(Visitor&& visitor) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        for (const auto& item : storeEntry_) {
+            visitor(*item.second);
+        }
+      }
+
+      /**
+       * Visits all entities with the given key inside the given index by const reference without copying them.
+       * The collection is read locked while visiting, so do not modify it from inside the visitor.
+       * @param name of the index
+       * @param key to look up
+       * @param visitor called for each matching entity
+       */
+      template <typename Visitor>
+      void forEachBy(std::string_view name, const Types::ID_TYPE& key, Visitor&& visitor) const
+      {
+        forEachBy(name, key.bytes(), std::forward<Visitor>(visitor));
+      }
+
+      template <typename Visitor>
+      void forEachBy(std::string_view name, std::string_view key, Visitor&& visitor) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        auto index = indexes_.find(name);
+        if (index == indexes_.end()) {
+            spdlog::error("Cannot look up {}, index not found: {}", printableKey(key), name);
+            return;
+        }
+        auto entry = index->second.entries.find(key);
+        if (entry != index->second.entries.end()) {
+            for (const auto& id : entry->second) {
+                visitor(*storeEntry_.at(id));
             }
-            catch (Types::ParseException const& e)
-            {
-                spdlog::error("Error in type conversion from json, not part of returned list: {}", e.what());
+        }
+      }
+
+      /**
+       * Returns a copy of the first entity matching the given predicate
+       * @param predicate called with each entity by const reference
+       * @return first matching entity or nullopt
+       */
+      template <typename Predicate>
+      std::optional<TYPE> find(Predicate&& predicate) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        for (const auto& item : storeEntry_) {
+            if (predicate(*item.second)) {
+                return *item.second;
             }
         }
-        return items;
+        return std::nullopt;
+      }
+
+      /**
+       * Counts the entities matching the given predicate without copying them
+       * @param predicate called with each entity by const reference
+       * @return number of matching entities
+       */
+      template <typename Predicate>
+      std::size_t count(Predicate&& predicate) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        std::size_t matches = 0;
+        for (const auto& item : storeEntry_) {
+            if (predicate(*item.second)) {
+                ++matches;
+            }
+        }
+        return matches;
+      }
+
+      std::size_t size() const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        return storeEntry_.size();
+      }
+
+      /**
+       * Estimates the memory held by this collection.
+       * This walks the indexes, so call it periodically rather than on every change.
+       * @return entity counts and byte estimate
+       */
+      CollectionMemoryUsage memoryUsage() const
+      {
+        // Rough size of a std::set / std::map node without its value: color, parent, left and right
+        constexpr std::size_t kTreeNode = 4 * sizeof(void*);
+        constexpr std::size_t idBytes = sizeof(Types::ID_TYPE);
+
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        CollectionMemoryUsage usage;
+        usage.entities = storeEntry_.size();
+        usage.peakEntities = peakSize_;
+        // Entities are allocated together with their shared_ptr control block
+        usage.bytes = storeEntry_.memoryUsage() + storeEntry_.size() * (sizeof(TYPE) + 2 * sizeof(void*) + 2 * sizeof(long));
+        for (const auto& index : indexes_) {
+            usage.bytes += kTreeNode + index.first.capacity() + index.second.entries.memoryUsage();
+            for (const auto& entry : index.second.entries) {
+                usage.bytes += entry.second.size() * (kTreeNode + idBytes);
+            }
+        }
+        usage.bytes += versions_.memoryUsage();
+        usage.bytes += changeLog_.size() * (kTreeNode + sizeof(std::uint64_t) + idBytes);
+        usage.bytes += unconfirmed_.size() * (kTreeNode + idBytes);
+        return usage;
+      }
+
+      /**
+       * Returns the version of this collection, which increases with every create, update and remove
+       * @return current version, 0 if nothing has been changed yet
+       */
+      std::uint64_t version() const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        return version_;
+      }
+
+      /**
+       * Returns the version of the collection, when the entity with the given id has been created, updated or removed the last time
+       * @param id of the entity
+       * @return version of the last change or 0, if the entity has never been touched
+       */
+      std::uint64_t versionOf(const Types::ID_TYPE& id) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        auto it = versions_.find(id);
+        return it != versions_.end() ? it->second : 0;
+      }
+
+      /**
+       * Signals, if removeAll() has been called after the given version.
+       * changedSince() does not list the entities removed by it, so everything obtained before has to be dropped.
+       * @param version previously obtained by version()
+       * @return true if the collection has been cleared since
+       */
+      bool clearedSince(std::uint64_t version) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        return clearedVersion_ > version;
+      }
+
+      /**
+       * Returns the ids of all entities created, updated or removed after the given version.
+       * This only costs the number of changes, use get() to find out if an entity still exists.
+       * Entities removed by removeAll() are not listed, check clearedSince() for these.
+       * @param version previously obtained by version()
+       * @return ids in order of their last change
+       */
+      std::vector<Types::ID_TYPE> changedSince(std::uint64_t version) const
+      {
+        std::shared_lock<std::shared_mutex> lock(mutex_store_);
+        std::vector<Types::ID_TYPE> ids;
+        for (auto it = changeLog_.upper_bound(version); it != changeLog_.end(); ++it) {
+            ids.push_back(it->second);
+        }
+        return ids;
       }
 
       void create(const json& payload)
       {
-        std::lock_guard<std::mutex> lock(mutex_store_);
-          if (validate(payload)) {
-              const Types::ID_TYPE _id = payload.at("_id").get<Types::ID_TYPE>();
-              storeEntry_[_id] = payload;
+          auto item = parse(payload);
+          if (item) {
+              create(std::move(*item));
           }
       }
 
-      void update(const json& payload)
+      /**
+       * Stores an entity, which has already been parsed, without parsing or copying it again
+       * @return the stored entity, share it instead of copying
+       */
+      std::shared_ptr<const TYPE> create(TYPE&& item)
       {
-        const Types::ID_TYPE& id = payload.at("_id").get<Types::ID_TYPE>();
-        std::lock_guard<std::mutex> lock(mutex_store_);
-        auto saved = storeEntry_[id];
-        storeEntry_[id].merge_patch(payload);
-        if (!validate(storeEntry_[id])) {
-            spdlog::error("Differential update destroyed JSON validity, patch not applied!");
-            storeEntry_[id] = saved;
+        std::shared_ptr<const TYPE> entity = makeEntity(std::move(item));
+        std::unique_lock<std::shared_mutex> lock(mutex_store_);
+        insertLocked(entity);
+        return entity;
+      }
+
+      /**
+       * Applies the given differential payload field by field to the stored entity.
+       * The patch is applied to a copy which replaces the stored entity, so an invalid patch leaves it untouched.
+       * @return the updated entity or nullptr, if the entity is unknown or the patch is invalid
+       */
+      std::shared_ptr<const TYPE> update(const json& payload)
+      {
+        const auto id = parseId(payload);
+        if (!id) {
+            return nullptr;
         }
+        std::unique_lock<std::shared_mutex> lock(mutex_store_);
+        return updateLocked(*id, payload);
       }
 
       void remove(const Types::ID_TYPE& id)
       {
-        std::lock_guard<std::mutex> lock(mutex_store_);
-        if (storeEntry_.find(id) != storeEntry_.end()) {
-            storeEntry_.erase(id);
+        std::unique_lock<std::shared_mutex> lock(mutex_store_);
+        removeLocked(id);
+      }
+
+      /**
+       * Removes all entities at once.
+       * Instead of removing each entity, the containers are swapped out under the lock and destroyed after unlocking,
+       * so readers and writers only wait a constant time, regardless of the size of the collection.
+       * The change set reports this as cleared and the collection version starts a new epoch, see clearedSince().
+       */
+      void removeAll()
+      {
+        struct Garbage {
+          Entities entities;
+          std::vector<FlatMap<std::set<Types::ID_TYPE>>> indexEntries;
+          FlatMap<std::uint64_t, std::hash<Types::ID_TYPE>, Types::ID_TYPE> versions;
+          std::map<std::uint64_t, Types::ID_TYPE> changeLog;
+          std::set<Types::ID_TYPE> unconfirmed;
+        } garbage;
+
+        std::unique_lock<std::shared_mutex> lock(mutex_store_);
+        garbage.indexEntries.reserve(indexes_.size());
+        std::swap(garbage.entities, storeEntry_);
+        for (auto& index : indexes_) {
+            garbage.indexEntries.emplace_back();
+            std::swap(garbage.indexEntries.back(), index.second.entries);
+        }
+        std::swap(garbage.versions, versions_);
+        std::swap(garbage.changeLog, changeLog_);
+        std::swap(garbage.unconfirmed, unconfirmed_);
+        pending_.recordCleared();
+        clearedVersion_ = ++version_;
+        dirty_ = true;
+      }
+
+      /**
+       * Allocates all entities stored from now on inside the given arena.
+       * Entities stored before keep their memory, the old arena is released as soon as none of its entities is referenced anymore.
+       * @param arena to use or nullptr to use the heap
+       */
+      void setArena(std::shared_ptr<StageArena> arena) noexcept
+      {
+        std::atomic_store(&arena_, std::move(arena));
+      }
+
+      std::shared_ptr<StageArena> getArena() const noexcept
+      {
+        return std::atomic_load(&arena_);
+      }
+
+      /**
+       * Marks all entities as unconfirmed, e.g. after loading them from a cache or after reconnecting.
+       * Entities, which are created again before purgeUnconfirmed() is called, become confirmed.
+       */
+      void markUnconfirmed()
+      {
+        std::unique_lock<std::shared_mutex> lock(mutex_store_);
+        unconfirmed_.clear();
+        for (const auto& item : storeEntry_) {
+            unconfirmed_.insert(item.first);
+        }
+      }
+
+      /**
+       * Removes all entities, which have been marked as unconfirmed and not been created again since
+       */
+      void purgeUnconfirmed()
+      {
+        std::unique_lock<std::shared_mutex> lock(mutex_store_);
+        auto unconfirmed = std::move(unconfirmed_);
+        unconfirmed_.clear();
+        for (const auto& id : unconfirmed) {
+            removeLocked(id);
+        }
+      }
+
+      bool validate(const json& payload) const
+      {
+        return parse(payload).has_value();
+      }
+
+    private:
+      /**
+       * Escapes non-printable bytes of an index key as \xHH, since id keys are raw binary
+       */
+      static std::string printableKey(std::string_view key)
+      {
+        static constexpr char kHex[] = "0123456789abcdef";
+        std::string printable;
+        printable.reserve(key.size());
+        for (const char c : key) {
+            const auto byte = static_cast<unsigned char>(c);
+            if (byte >= 0x20 && byte < 0x7f && byte != '\\') {
+                printable += c;
+            } else {
+                printable += "\\x";
+                printable += kHex[byte >> 4];
+                printable += kHex[byte & 0xf];
+            }
+        }
+        return printable;
+      }
+
+      void insertLocked(std::shared_ptr<const TYPE> entity)
+      {
+        if (!unconfirmed_.empty()) {
+            unconfirmed_.erase(entity->_id);
+        }
+        auto it = storeEntry_.find(entity->_id);
+        if (it != storeEntry_.end()) {
+            reindex(*it->second, *entity);
+            it->second = std::move(entity);
+            pending_.recordChanged(it->first);
         }
         else {
-            spdlog::error("Cannot remove object, id not found in storeEntry: {}", id);
+            it = storeEntry_.emplace(entity->_id, std::move(entity)).first;
+            pending_.recordAdded(it->first);
+            peakSize_ = std::max(peakSize_, storeEntry_.size());
+            addToIndexes(*it->second);
         }
+        touchLocked(it->first);
+        dirty_ = true;
       }
 
-      void removeAll()
+      std::shared_ptr<const TYPE> updateLocked(const Types::ID_TYPE& id, const json& payload)
+      {
+        auto it = storeEntry_.find(id);
+        if (it == storeEntry_.end()) {
+            spdlog::error("Cannot update object, id not found in storeEntry: {}", id.str());
+            return nullptr;
+        }
+        // The copy is patched in place, it only replaces the stored entity if the patch is valid
+        auto entity = makeEntity(*it->second);
+        try {
+            patch_from_json(payload, *entity);
+        }
+        catch (Types::ParseException const& e) {
+            spdlog::error("Differential update destroyed validity, patch not applied: {}", e.what());
+            return nullptr;
+        }
+        reindex(*it->second, *entity);
+        it->second = entity;
+        pending_.recordChanged(it->first);
+        touchLocked(it->first);
+        dirty_ = true;
+        return entity;
+      }
+
+      void removeLocked(const Types::ID_TYPE& id)
+      {
+        auto it = storeEntry_.find(id);
+        if (it != storeEntry_.end()) {
+            if (!unconfirmed_.empty()) {
+                unconfirmed_.erase(it->first);
+            }
+            removeFromIndexes(*it->second);
+            pending_.recordRemoved(it->first);
+            touchLocked(it->first);
+            storeEntry_.erase(it);
+            dirty_ = true;
+        }
+        else {
+            spdlog::error("Cannot remove object, id not found in storeEntry: {}", id.str());
+        }
+      }
+
+      /**
+       * Constructs an entity inside the current arena, it is only modified before it is stored
+       */
+      template <typename... Args>
+      std::shared_ptr<TYPE> makeEntity(Args&&... args) const
+      {
+        auto arena = std::atomic_load(&arena_);
+        if (arena) {
+            return std::allocate_shared<TYPE>(StageArenaAllocator<TYPE>(std::move(arena)), std::forward<Args>(args)...);
+        }
+        return std::make_shared<TYPE>(std::forward<Args>(args)...);
+      }
+
+      /**
+       * Stamps the entity with a new version, so each id appears only once inside the change log
+       */
+      void touchLocked(const Types::ID_TYPE& id)
+      {
+        auto& entityVersion = versions_[id];
+        if (entityVersion != 0) {
+            changeLog_.erase(entityVersion);
+        }
+        entityVersion = ++version_;
+        changeLog_.emplace(entityVersion, id);
+      }
+
+      struct Index {
+        IndexKey key;
+        FlatMap<std::set<Types::ID_TYPE>> entries;
+      };
+
+      static void addToIndex(Index& index, const TYPE& item)
+      {
+          auto key = index.key(item);
+          if (key) {
+              index.entries[*key].insert(item._id);
+          }
+      }
+
+      void addToIndexes(const TYPE& item)
+      {
+          for (auto& index : indexes_) {
+              addToIndex(index.second, item);
+          }
+      }
+
+      static void removeFromIndex(Index& index, const std::string& key, const Types::ID_TYPE& id)
+      {
+          auto entry = index.entries.find(key);
+          if (entry != index.entries.end()) {
+              entry->second.erase(id);
+              if (entry->second.empty()) {
+                  index.entries.erase(entry);
+              }
+          }
+      }
+
+      void removeFromIndexes(const TYPE& item)
       {
-        std::lock_guard<std::mutex> lock(mutex_store_);
-        storeEntry_.clear();
+          for (auto& index : indexes_) {
+              auto key = index.second.key(item);
+              if (key) {
+                  removeFromIndex(index.second, *key, item._id);
+              }
+          }
       }
 
-        bool validate(const json& payload) const
+      /**
+       * Moves a replaced entity inside the indexes, only touching those where its key has changed
+       */
+      void reindex(const TYPE& before, const TYPE& after)
+      {
+          for (auto& index : indexes_) {
+              auto previousKey = index.second.key(before);
+              auto key = index.second.key(after);
+              if (previousKey == key) {
+                  continue;
+              }
+              if (previousKey) {
+                  removeFromIndex(index.second, *previousKey, before._id);
+              }
+              if (key) {
+                  index.second.entries[*key].insert(after._id);
+              }
+          }
+      }
+
+      static std::optional<TYPE> parse(const json& payload)
       {
             try {
-                payload.get<TYPE>();
-                return true;
+                return payload.get<TYPE>();
             }
             catch (Types::ParseException const& e) {
                 spdlog::warn("Error in type validation from json: {}", e.what());
             }
-            return false;
+            return std::nullopt;
       }
 
-    private:
-      mutable std::mutex mutex_store_;
-      std::map<std::string, json> storeEntry_;
+      /**
+       * Reads the id of a differential payload without throwing
+       * @return the id or nullopt, if it is missing or not a valid ObjectId
+       */
+      static std::optional<Types::ID_TYPE> parseId(const json& payload)
+      {
+        if (payload.is_object()) {
+            auto it = payload.find("_id");
+            if (it != payload.end() && it->is_string()) {
+                auto id = Types::ID_TYPE::fromHex(it->template get_ref<const std::string&>());
+                if (id) {
+                    return id;
+                }
+            }
+        }
+        spdlog::error("Cannot update object, payload has no valid _id");
+        return std::nullopt;
+      }
+
+      using Entities = FlatMap<std::shared_ptr<const TYPE>, std::hash<Types::ID_TYPE>, Types::ID_TYPE>;
+
+      mutable std::shared_mutex mutex_store_;
+      // Held by publish() only, so writers are not blocked while the next snapshot is built
+      std::mutex mutex_publish_;
+      Entities storeEntry_;
+      // Transparent, so indexes are looked up by std::string_view without building a std::string
+      std::map<std::string, Index, std::less<>> indexes_;
+      bool dirty_ = false;
+      StoreChanges pending_;
+      std::set<Types::ID_TYPE> unconfirmed_;
+      std::uint64_t version_ = 0;
+      std::uint64_t clearedVersion_ = 0;
+      std::size_t peakSize_ = 0;
+      FlatMap<std::uint64_t, std::hash<Types::ID_TYPE>, Types::ID_TYPE> versions_;
+      std::map<std::uint64_t, Types::ID_TYPE> changeLog_;
+      std::shared_ptr<const Snapshot> published_;
+      std::shared_ptr<StageArena> arena_;
     };
 
     template <class T>
@@ -134,8 +919,199 @@ namespace DigitalStage {
 
     class Store {
     public:
+      /**
+       * Consistent, immutable view of the whole store at the time of the last publish()
+       */
+      struct Snapshot {
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::Device>::Snapshot> devices;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::User>::Snapshot> users;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::Stage>::Snapshot> stages;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::Group>::Snapshot> groups;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::StageMember>::Snapshot> stageMembers;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::StageDevice>::Snapshot> stageDevices;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::VideoTrack>::Snapshot> videoTracks;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::AudioTrack>::Snapshot> audioTracks;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::CustomGroup>::Snapshot> customGroups;
+        std::shared_ptr<const StoreEntry<DigitalStage::Types::SoundCard>::Snapshot> soundCards;
+
+        std::optional<Types::ID_TYPE> localDeviceId;
+        std::optional<Types::ID_TYPE> userId;
+        std::optional<Types::ID_TYPE> stageId;
+        std::optional<Types::ID_TYPE> stageMemberId;
+        std::optional<Types::ID_TYPE> groupId;
+        std::optional<Types::ID_TYPE> stageDeviceId;
+      };
+
+      /**
+       * All changes of the store between two publishes, one entry per collection
+       */
+      struct ChangeSet {
+        StoreChanges devices;
+        StoreChanges users;
+        StoreChanges stages;
+        StoreChanges groups;
+        StoreChanges stageMembers;
+        StoreChanges stageDevices;
+        StoreChanges videoTracks;
+        StoreChanges audioTracks;
+        StoreChanges customGroups;
+        StoreChanges soundCards;
+
+        bool empty() const;
+      };
+
+      /**
+       * Estimated memory usage of the whole store
+       */
+      struct MemoryUsage {
+        CollectionMemoryUsage devices;
+        CollectionMemoryUsage users;
+        CollectionMemoryUsage stages;
+        CollectionMemoryUsage groups;
+        CollectionMemoryUsage stageMembers;
+        CollectionMemoryUsage stageDevices;
+        CollectionMemoryUsage videoTracks;
+        CollectionMemoryUsage audioTracks;
+        CollectionMemoryUsage customGroups;
+        CollectionMemoryUsage soundCards;
+
+        std::size_t entities = 0;
+        std::size_t bytes = 0;
+        /**
+         * Highest byte estimate ever returned by memoryUsage()
+         */
+        std::size_t peakBytes = 0;
+      };
+
+      /**
+       * Collects operations on multiple collections and applies them with commit(),
+       * taking each collection lock once and publishing a single snapshot and change notification afterwards.
+       * Operations are dropped, if the transaction is destroyed without commit.
+       */
+      class Transaction {
+      public:
+        explicit Transaction(Store& store)
+            : devices(store.devices), users(store.users), stages(store.stages), groups(store.groups),
+              stageMembers(store.stageMembers), stageDevices(store.stageDevices), videoTracks(store.videoTracks),
+              audioTracks(store.audioTracks), customGroups(store.customGroups), soundCards(store.soundCards), store_(store)
+        {
+        }
+
+        StoreEntry<DigitalStage::Types::Device>::Batch devices;
+        StoreEntry<DigitalStage::Types::User>::Batch users;
+        StoreEntry<DigitalStage::Types::Stage>::Batch stages;
+        StoreEntry<DigitalStage::Types::Group>::Batch groups;
+        StoreEntry<DigitalStage::Types::StageMember>::Batch stageMembers;
+        StoreEntry<DigitalStage::Types::StageDevice>::Batch stageDevices;
+        StoreEntry<DigitalStage::Types::VideoTrack>::Batch videoTracks;
+        StoreEntry<DigitalStage::Types::AudioTrack>::Batch audioTracks;
+        StoreEntry<DigitalStage::Types::CustomGroup>::Batch customGroups;
+        StoreEntry<DigitalStage::Types::SoundCard>::Batch soundCards;
+
+        void commit();
+
+      private:
+        Store& store_;
+      };
+
       Store();
 
+      /**
+       * Starts a new transaction for applying a bulk of changes at once
+       * @return transaction, call commit() to apply it
+       */
+      Transaction transaction();
+
+      /**
+       * Emitted once after each publish, which contains any changes.
+       * All changes since the last publish are delivered as one coalesced change set.
+       */
+      sigslot::signal<const ChangeSet&> changed;
+
+      /**
+       * Returns the last published state of the store.
+       * Use this inside real-time threads, since it never waits for the network thread applying changes.
+       * @return immutable snapshot of all collections
+       */
+      std::shared_ptr<const Snapshot> snapshot() const noexcept;
+
+      /**
+       * Publishes the current state of all collections as a new snapshot and notifies about the changes since the last publish.
+       * The client calls this after each handled message.
+       * Concurrent calls are serialized, slots of the notifications may publish again.
+       */
+      void publish();
+
+      /**
+       * Returns the whole state of all collections
+       * @return copy of all entities
+       */
+      DigitalStage::Types::WholeStage getWholeStage() const;
+
+      /**
+       * Writes all entities and the local IDs as compact binary (CBOR) cache file.
+       * The file is written to a temporary file first and then renamed, so an existing cache is never left half written.
+       * @param path of the cache file
+       * @return true if the cache has been written
+       */
+      bool save(const std::string& path) const;
+
+      /**
+       * Loads a cache file written by save() and publishes its state immediately,
+       * so the UI and mixer can work with it before the server delivered the current state.
+       * All loaded entities are marked as unconfirmed, the client purges them, if the server does not send them again until READY.
+       * @param path of the cache file
+       * @return true if the cache has been loaded, false if it is missing, corrupted or of another format version
+       */
+      bool load(const std::string& path);
+
+      /**
+       * Marks all entities and the current stage as unconfirmed.
+       * The client calls this after reconnecting, since the server sends the whole state again.
+       */
+      void markUnconfirmed();
+
+      /**
+       * Removes all unconfirmed entities and leaves an unconfirmed stage.
+       * The client calls this after receiving READY, so everything the server did not send again is removed.
+       */
+      void purgeUnconfirmed();
+
+      /**
+       * Starts a new arena for the stage scoped collections (stage members, stage devices, audio and video tracks and custom groups).
+       * The client calls this when joining a stage, so all entities of a stage session share one arena,
+       * which is released as a whole after leaving the stage.
+       */
+      void beginStageArena();
+
+      /**
+       * Lets the stage scoped collections use the heap again, the arena is released when its last entity is gone
+       */
+      void endStageArena();
+
+      /**
+       * Hierarchy of stages, groups, stage members, stage devices and tracks.
+       * It is updated by publish(), so it always reflects the last published state.
+       */
+      StageTree stageTree;
+
+      /**
+       * Estimates the memory held by all collections and updates the high-water mark
+       * @return per collection and total estimates
+       */
+      MemoryUsage memoryUsage() const;
+
+      /**
+       * Emitted by publish() with the current memory usage, at most once per report interval
+       */
+      sigslot::signal<const MemoryUsage&> memoryUsageReported;
+
+      /**
+       * Enables periodic memory reports via memoryUsageReported
+       * @param interval minimum time between two reports, zero disables reporting
+       */
+      void setMemoryUsageReportInterval(std::chrono::milliseconds interval);
+
       void setReady(bool ready);
       /**
        * Signals, if the initial state has been fetched and the store is ready to use.
@@ -251,7 +1227,7 @@ namespace DigitalStage {
        * Sets the given TURN/STUN username
        * @param username
        */
-      void setTurnPassword(const Types::ID_TYPE& username);
+      void setTurnPassword(const std::string& password);
 
       /**
        * Returns the password to authenticate on the TURN servers.
@@ -286,7 +1262,7 @@ namespace DigitalStage {
       // Audio tracks
       using AudioTracks = std::vector<DigitalStage::Types::AudioTrack>;
       StoreEntry<DigitalStage::Types::AudioTrack> audioTracks;
-      std::optional<DigitalStage::Types::AudioTrack> getAudioTrackByUuid(const Types::ID_TYPE & uuid) const;
+      std::optional<DigitalStage::Types::AudioTrack> getAudioTrackByUuid(const std::string& uuid) const;
       AudioTracks getAudioTracksByStageDevice(const Types::ID_TYPE& stageDeviceId) const;
       AudioTracks getAudioTracksByStageMember(const Types::ID_TYPE& stageMemberId) const;
       AudioTracks getAudioTracksByGroup(const Types::ID_TYPE& groupId) const;
@@ -315,6 +1291,10 @@ namespace DigitalStage {
       std::optional<DigitalStage::Types::SoundCard> getOutputSoundCard() const;
 
     protected:
+      void updateStageTree(const ChangeSet& changes);
+      template <class T, class ParentOf>
+      void updateStageTree(const StoreEntry<T>& entry, const StoreChanges& changes, StageTree::Level level, ParentOf parentOf);
+
       std::atomic<bool> isReady_;
 
       LockedOptionalValue<Types::ID_TYPE> userId_;
@@ -328,6 +1308,16 @@ namespace DigitalStage {
       LockedOptionalValue<std::string> turn_password_;
       mutable std::mutex turn_url_mutex_;
       std::vector<std::string> turn_urls_;
+
+      // Recursive, since slots connected to changed may publish again
+      std::recursive_mutex publish_mutex_;
+      std::shared_ptr<const Snapshot> snapshot_;
+      std::atomic<bool> stageUnconfirmed_ {false};
+
+      mutable std::atomic<std::size_t> peakBytes_ {0};
+      std::mutex memory_report_mutex_;
+      std::chrono::milliseconds memoryReportInterval_ {0};
+      std::chrono::steady_clock::time_point lastMemoryReport_;
     };
   } // namespace Api
 } // namespace DigitalStage
@@ -21,18 +21,18 @@ class AudioMixer {
  public:
   explicit AudioMixer(std::shared_ptr<DigitalStage::Api::Client> client, bool use_balance = false);
 
-  void applyGain(const std::string &audio_track_id, T *data, std::size_t frame_count);
-  T applyGain(const std::string &audio_track_id, T data);
-  std::optional<VolumeInfo<T>> getGain(const std::string &audio_track_id) const;
+  void applyGain(const DigitalStage::Types::ID_TYPE &audio_track_id, T *data, std::size_t frame_count);
+  T applyGain(const DigitalStage::Types::ID_TYPE &audio_track_id, T data);
+  std::optional<VolumeInfo<T>> getGain(const DigitalStage::Types::ID_TYPE &audio_track_id) const;
 
-  sigslot::signal<std::string, std::pair<T, bool>> onGainChanged;
+  sigslot::signal<DigitalStage::Types::ID_TYPE, std::pair<T, bool>> onGainChanged;
  private:
   void attachHandlers();
   std::pair<T, bool> calculateVolume(const DigitalStage::Types::AudioTrack &audio_track,
                                      shared_ptr<DigitalStage::Api::Store> store);
   static double calculateBalance(double balance, bool is_local);
 
-  std::unordered_map<std::string, std::pair<T, bool>> volume_map_;
+  std::unordered_map<DigitalStage::Types::ID_TYPE, std::pair<T, bool>> volume_map_;
   std::shared_ptr<DigitalStage::Api::Client> client_;
   std::shared_ptr<DigitalStage::Api::Client::Token> token_;
   bool use_balance_;
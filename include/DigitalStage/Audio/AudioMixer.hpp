@@ -16,7 +16,7 @@ namespace DigitalStage::Audio {
     }
 
     template<class T>
-    void AudioMixer<T>::applyGain(const std::string& audio_track_id,
+    void AudioMixer<T>::applyGain(const DigitalStage::Types::ID_TYPE& audio_track_id,
         T* data,
         std::size_t frame_count) {
         if (volume_map_.count(audio_track_id)) {
@@ -29,7 +29,7 @@ namespace DigitalStage::Audio {
     }
 
     template<class T>
-    T AudioMixer<T>::applyGain(const std::string& audio_track_id, T data) {
+    T AudioMixer<T>::applyGain(const DigitalStage::Types::ID_TYPE& audio_track_id, T data) {
         if (volume_map_.count(audio_track_id)) {
             auto item = volume_map_[audio_track_id];
             return item.second ? 0 : data * (item.first);
@@ -55,7 +55,7 @@ namespace DigitalStage::Audio {
             volume_map_[audio_track._id] = calculateVolume(audio_track, store_ptr.lock());
           }
         }, token_);
-        client_->audioTrackChanged.connect([this](const std::string& audio_track_id, const nlohmann::json& update,
+        client_->audioTrackChanged.connect([this](const DigitalStage::Types::ID_TYPE& audio_track_id, const nlohmann::json& update,
             std::weak_ptr<DigitalStage::Api::Store> store_ptr) {
             if (update.contains("volume") || update.contains("muted")) {
                 if(store_ptr.expired()) {
@@ -70,7 +70,7 @@ namespace DigitalStage::Audio {
         client_->audioTrackRemoved.connect([this](const DigitalStage::Types::AudioTrack& audio_track, std::weak_ptr<DigitalStage::Api::Store> store_ptr) {
             volume_map_.erase(audio_track._id);
         }, token_);
-        client_->stageDeviceChanged.connect([this](const std::string& stage_device_id, const nlohmann::json& update,
+        client_->stageDeviceChanged.connect([this](const DigitalStage::Types::ID_TYPE& stage_device_id, const nlohmann::json& update,
             std::weak_ptr<DigitalStage::Api::Store> store_ptr) {
             if (update.contains("volume") || update.contains("muted")) {
                 if(store_ptr.expired()) {
@@ -78,36 +78,28 @@ namespace DigitalStage::Audio {
                 }
                 auto store = store_ptr.lock();
                 // Find and update all related audio tracks
-                for (const auto& audio_track : store->audioTracks.getAll()) {
-                    if (audio_track.stageDeviceId == stage_device_id) {
-                        volume_map_[audio_track._id] = calculateVolume(audio_track, store);
-                    }
+                for (const auto& audio_track : store->getAudioTracksByStageDevice(stage_device_id)) {
+                    volume_map_[audio_track._id] = calculateVolume(audio_track, store);
                 }
             }
         }, token_);
-        client_->stageMemberChanged.connect([this](const std::string& stage_member_id, const nlohmann::json& update,
+        client_->stageMemberChanged.connect([this](const DigitalStage::Types::ID_TYPE& stage_member_id, const nlohmann::json& update,
                                                    std::weak_ptr<DigitalStage::Api::Store> store_ptr) {
             if (!store_ptr.expired() && (update.contains("volume") || update.contains("muted") || update.contains("groupId"))) {
                 // Find and update all related audio tracks
                 auto store = store_ptr.lock();
-                for (const auto& audio_track : store->audioTracks.getAll()) {
-                    if (audio_track.stageMemberId == stage_member_id) {
-                        volume_map_[audio_track._id] = calculateVolume(audio_track, store);
-                    }
+                for (const auto& audio_track : store->getAudioTracksByStageMember(stage_member_id)) {
+                    volume_map_[audio_track._id] = calculateVolume(audio_track, store);
                 }
             }
         }, token_);
-        client_->groupChanged.connect([this](const std::string& group_id, const nlohmann::json& update,
+        client_->groupChanged.connect([this](const DigitalStage::Types::ID_TYPE& group_id, const nlohmann::json& update,
             std::weak_ptr<DigitalStage::Api::Store> store_ptr) {
             if (!store_ptr.expired() && (update.contains("volume") || update.contains("muted"))) {
                 // Find and update all related audio tracks
                 auto store = store_ptr.lock();
-                for (const auto& stage_member : store->getStageMembersByGroup(group_id)) {
-                    for (const auto& audio_track : store->audioTracks.getAll()) {
-                        if (audio_track.stageMemberId == stage_member._id) {
-                            volume_map_[audio_track._id] = calculateVolume(audio_track, store);
-                        }
-                    }
+                for (const auto& audio_track : store->getAudioTracksByGroup(group_id)) {
+                    volume_map_[audio_track._id] = calculateVolume(audio_track, store);
                 }
             }
         }, token_);
@@ -119,16 +111,12 @@ namespace DigitalStage::Audio {
             auto store = store_ptr.lock();
             auto group_id = store->getGroupId();
             if (group_id && custom_group.targetGroupId == group_id) {
-                for (const auto& stage_member : store->getStageMembersByGroup(custom_group.groupId)) {
-                    for (const auto& audio_track : store->audioTracks.getAll()) {
-                        if (audio_track.stageMemberId == stage_member._id) {
-                            volume_map_[audio_track._id] = calculateVolume(audio_track, store);
-                        }
-                    }
+                for (const auto& audio_track : store->getAudioTracksByGroup(custom_group.groupId)) {
+                    volume_map_[audio_track._id] = calculateVolume(audio_track, store);
                 }
             }
         }, token_);
-        client_->customGroupChanged.connect([this](const std::string& custom_group_id,
+        client_->customGroupChanged.connect([this](const DigitalStage::Types::ID_TYPE& custom_group_id,
             const nlohmann::json& update,
             std::weak_ptr<DigitalStage::Api::Store> store_ptr) {
             if (update.contains("volume") || update.contains("muted")) {
@@ -141,12 +129,8 @@ namespace DigitalStage::Audio {
                 auto group_id = store->getGroupId();
                 if (group_id && custom_group->targetGroupId == group_id) {
                     // Find and update all related audio tracks
-                    for (const auto& stage_member : store->getStageMembersByGroup(custom_group->groupId)) {
-                        for (const auto& audio_track : store->audioTracks.getAll()) {
-                            if (audio_track.stageMemberId == stage_member._id) {
-                                volume_map_[audio_track._id] = calculateVolume(audio_track, store);
-                            }
-                        }
+                    for (const auto& audio_track : store->getAudioTracksByGroup(custom_group->groupId)) {
+                        volume_map_[audio_track._id] = calculateVolume(audio_track, store);
                     }
                 }
             }
@@ -159,12 +143,8 @@ namespace DigitalStage::Audio {
             auto store = store_ptr.lock();
             auto group_id = store->getGroupId();
             if (group_id && custom_group.targetGroupId == group_id) {
-                for (const auto& stage_member : store->getStageMembersByGroup(custom_group.groupId)) {
-                    for (const auto& audio_track : store->audioTracks.getAll()) {
-                        if (audio_track.stageMemberId == stage_member._id) {
-                            volume_map_[audio_track._id] = calculateVolume(audio_track, store);
-                        }
-                    }
+                for (const auto& audio_track : store->getAudioTracksByGroup(custom_group.groupId)) {
+                    volume_map_[audio_track._id] = calculateVolume(audio_track, store);
                 }
             }
         }, token_);
@@ -185,12 +165,12 @@ namespace DigitalStage::Audio {
                                                       std::shared_ptr<DigitalStage::Api::Store> store) {
         auto group_id = store->getGroupId();
 
-        // Get related stage member
-        auto stage_member = store->stageMembers.get(audio_track.stageMemberId);
+        // Get related stage member (shared lookups do not copy the entities)
+        auto stage_member = store->stageMembers.getShared(audio_track.stageMemberId);
         assert(stage_member);
 
         // Get related group
-        auto group = stage_member->groupId ? store->groups.get(*stage_member->groupId) : std::nullopt;
+        auto group = stage_member->groupId ? store->groups.getShared(*stage_member->groupId) : nullptr;
         auto custom_group =
             (group_id && stage_member->groupId) ? store->getCustomGroupByGroupAndTargetGroup(*stage_member->groupId, *group_id)
             : std::nullopt;
@@ -203,7 +183,7 @@ namespace DigitalStage::Audio {
             std::cout << "(custom-group) " << std::to_string(custom_group->volume) << std::endl;
         }
         else {
-            if (group.has_value()) {
+            if (group) {
                 std::cout << "(group) " << std::to_string(group->volume) << std::endl;
             }
         }
@@ -218,8 +198,9 @@ namespace DigitalStage::Audio {
         // Get balance (0 = only me, 1 = only others)
         if (use_balance_) {
             auto local_device_id = store->getLocalDeviceId();
-            if (local_device_id) {
-                auto balance = calculateBalance(store->getLocalDevice()->balance, audio_track.deviceId == *local_device_id);
+            auto local_device = local_device_id ? store->devices.getShared(*local_device_id) : nullptr;
+            if (local_device) {
+                auto balance = calculateBalance(local_device->balance, audio_track.deviceId == *local_device_id);
                 std::cout << "(balance) " << balance;
                 volume *= balance;
             }
@@ -247,7 +228,7 @@ namespace DigitalStage::Audio {
 
     template<class T>
     std::optional<VolumeInfo<T>>
-        AudioMixer<T>::getGain(const std::string& audio_track_id) const {
+        AudioMixer<T>::getGain(const DigitalStage::Types::ID_TYPE& audio_track_id) const {
         if (volume_map_.count(audio_track_id)) {
             return volume_map_.at(audio_track_id);
         }
@@ -1,10 +1,16 @@
 #ifndef DS_TYPES
 #define DS_TYPES
 
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <nlohmann/json.hpp>
 #include <set>
 #include <string>
+#include <string_view>
 #include <optional>
 
 namespace DigitalStage::Types {
@@ -44,7 +50,154 @@ void optional_to_json(J &j, const char *name, const std::optional<T> &value) {
   }
 }
 
-using ID_TYPE = std::string;
+/**
+ * Applies the value of key to target, if the (differential) payload contains it
+ */
+template<typename ValueType>
+void field_patch_from_json(const nlohmann::json &json, const std::string &key, ValueType &target) {
+  if (json.contains(key)) {
+    required_from_json(json, key, target);
+  }
+}
+
+/**
+ * Applies the value of name to target, if the (differential) payload contains it.
+ * A null value resets the target, like merge_patch would remove the key.
+ */
+template<class J, class T>
+void optional_patch_from_json(const J &j, const char *name, std::optional<T> &target) {
+  const auto it = j.find(name);
+  if (it == j.end()) {
+    return;
+  }
+  if (it->is_null()) {
+    target = std::nullopt;
+    return;
+  }
+  try {
+    target = it->template get<T>();
+  } catch (const nlohmann::json::exception &e) {
+    throw DigitalStage::Types::ParseException(std::string(name) + ": " + e.what());
+  }
+}
+
+/**
+ * Compact 12 byte MongoDB ObjectId.
+ * It is parsed from and printed as 24 character hex string, which is the form used by the API.
+ * Copying, hashing and comparing never allocates and only touches these 12 bytes.
+ */
+class ObjectId {
+ public:
+  static constexpr std::size_t kSize = 12;
+
+  /**
+   * Creates the all zero id
+   */
+  ObjectId() noexcept = default;
+
+  /**
+   * Parses the given 24 character hex string.
+   * Explicit, since it throws, use fromHex() to parse untrusted input.
+   * @throws ParseException if the string is not a valid ObjectId
+   */
+  explicit ObjectId(std::string_view hex) {
+    if (!parse(hex, bytes_)) {
+      throw ParseException("Invalid ObjectId '" + std::string(hex) + "'");
+    }
+  }
+  explicit ObjectId(const std::string &hex) : ObjectId(std::string_view(hex)) {}
+  explicit ObjectId(const char *hex) : ObjectId(std::string_view(hex)) {}
+
+  /**
+   * Parses the given 24 character hex string without throwing
+   * @return the id or nullopt, if the string is not a valid ObjectId
+   */
+  static std::optional<ObjectId> fromHex(std::string_view hex) noexcept {
+    ObjectId id;
+    if (parse(hex, id.bytes_)) {
+      return id;
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Returns the 24 character hex representation
+   */
+  std::string str() const {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string hex(2 * kSize, '0');
+    for (std::size_t i = 0; i < kSize; ++i) {
+      hex[2 * i] = digits[bytes_[i] >> 4];
+      hex[2 * i + 1] = digits[bytes_[i] & 0x0f];
+    }
+    return hex;
+  }
+
+  /**
+   * Returns the raw 12 bytes, e.g. to use them as compact key
+   */
+  std::string_view bytes() const noexcept {
+    return {reinterpret_cast<const char *>(bytes_.data()), kSize};
+  }
+
+  std::size_t hash() const noexcept {
+    std::uint64_t head;
+    std::uint32_t tail;
+    std::memcpy(&head, bytes_.data(), sizeof(head));
+    std::memcpy(&tail, bytes_.data() + sizeof(head), sizeof(tail));
+    // The leading timestamp bytes hardly differ, so mix all bits
+    std::uint64_t hash = (head ^ (std::uint64_t(tail) << 32 | tail)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(hash ^ (hash >> 29));
+  }
+
+  friend bool operator==(const ObjectId &lhs, const ObjectId &rhs) noexcept {
+    return lhs.bytes_ == rhs.bytes_;
+  }
+  friend bool operator!=(const ObjectId &lhs, const ObjectId &rhs) noexcept {
+    return lhs.bytes_ != rhs.bytes_;
+  }
+  friend bool operator<(const ObjectId &lhs, const ObjectId &rhs) noexcept {
+    return lhs.bytes_ < rhs.bytes_;
+  }
+  friend std::ostream &operator<<(std::ostream &os, const ObjectId &id) {
+    return os << id.str();
+  }
+
+ private:
+  static bool parse(std::string_view hex, std::array<std::uint8_t, kSize> &bytes) noexcept {
+    if (hex.size() != 2 * kSize) {
+      return false;
+    }
+    for (std::size_t i = 0; i < kSize; ++i) {
+      const int high = digit(hex[2 * i]);
+      const int low = digit(hex[2 * i + 1]);
+      if (high < 0 || low < 0) {
+        return false;
+      }
+      bytes[i] = static_cast<std::uint8_t>(high << 4 | low);
+    }
+    return true;
+  }
+
+  static int digit(char c) noexcept {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  std::array<std::uint8_t, kSize> bytes_{};
+};
+
+inline void to_json(json &j, const ObjectId &p) {
+  j = p.str();
+}
+
+inline void from_json(const json &j, ObjectId &p) {
+  p = ObjectId(j.get<std::string>());
+}
+
+using ID_TYPE = ObjectId;
 
 struct Device {
   ID_TYPE _id;
@@ -491,6 +644,37 @@ inline void from_json(const json &j, Device &p) {
   optional_from_json(j, "egoGain", p.egoGain);
 }
 
+inline void patch_from_json(const json &j, Device &p) {
+  field_patch_from_json(j, "userId", p.userId);
+  field_patch_from_json(j, "uuid", p.uuid);
+  field_patch_from_json(j, "type", p.type);
+  field_patch_from_json(j, "online", p.online);
+  field_patch_from_json(j, "canVideo", p.canVideo);
+  field_patch_from_json(j, "canAudio", p.canAudio);
+  field_patch_from_json(j, "sendVideo", p.sendVideo);
+  field_patch_from_json(j, "sendAudio", p.sendAudio);
+  field_patch_from_json(j, "receiveVideo", p.receiveVideo);
+  field_patch_from_json(j, "receiveAudio", p.receiveAudio);
+  field_patch_from_json(j, "volume", p.volume);
+  field_patch_from_json(j, "balance", p.balance);
+
+  optional_patch_from_json(j, "audioDriver", p.audioDriver);
+  optional_patch_from_json(j, "audioEngine", p.audioEngine);
+  optional_patch_from_json(j, "inputSoundCardId", p.inputSoundCardId);
+  optional_patch_from_json(j, "outputSoundCardId", p.outputSoundCardId);
+
+  // ov specific
+  optional_patch_from_json(j, "ovReceiverType", p.ovReceiverType);
+  optional_patch_from_json(j, "ovSenderJitter", p.ovSenderJitter);
+  optional_patch_from_json(j, "ovReceiverJitter", p.ovReceiverJitter);
+  optional_patch_from_json(j, "ovP2p", p.ovP2p);
+  optional_patch_from_json(j, "ovRenderReverb", p.ovRenderReverb);
+  optional_patch_from_json(j, "ovReverbGain", p.ovReverbGain);
+  optional_patch_from_json(j, "ovRenderISM", p.ovRenderISM);
+  optional_patch_from_json(j, "ovRawMode", p.ovRawMode);
+  optional_patch_from_json(j, "egoGain", p.egoGain);
+}
+
 inline void to_json(json &j, const stage_mediasoup_t &p) {
   j = json{{"url", p.url}, {"port", p.port}};
 }
@@ -571,6 +755,39 @@ inline void from_json(const json &j, Stage &p) {
   optional_from_json(j, "ovRenderAmbient", p.ovRenderAmbient);
 }
 
+inline void patch_from_json(const json &j, Stage &p) {
+  field_patch_from_json(j, "name", p.name);
+  field_patch_from_json(j, "description", p.description);
+  field_patch_from_json(j, "admins", p.admins);
+  field_patch_from_json(j, "soundEditors", p.soundEditors);
+  field_patch_from_json(j, "videoType", p.videoType);
+  field_patch_from_json(j, "audioType", p.audioType);
+  field_patch_from_json(j, "width", p.width);
+  field_patch_from_json(j, "length", p.length);
+  field_patch_from_json(j, "height", p.height);
+  field_patch_from_json(j, "absorption", p.absorption);
+  field_patch_from_json(j, "reflection", p.reflection);
+  optional_patch_from_json(j, "iconUrl", p.iconUrl);
+  optional_patch_from_json(j, "password", p.password);
+  optional_patch_from_json(j, "videoRouter", p.videoRouter);
+  optional_patch_from_json(j, "audioRouter", p.audioRouter);
+  optional_patch_from_json(j, "mediasoup", p.mediasoup);
+
+  optional_patch_from_json(j, "jammerIpv4", p.jammerIpv4);
+  optional_patch_from_json(j, "jammerIpv6", p.jammerIpv6);
+  optional_patch_from_json(j, "jammerKey", p.jammerKey);
+  optional_patch_from_json(j, "jammerPort", p.jammerPort);
+
+  optional_patch_from_json(j, "ovAmbientLevel", p.ovAmbientLevel);
+  optional_patch_from_json(j, "ovAmbientSoundUrl", p.ovAmbientSoundUrl);
+  optional_patch_from_json(j, "ovIpv4", p.ovIpv4);
+  optional_patch_from_json(j, "ovIpv6", p.ovIpv6);
+  optional_patch_from_json(j, "ovJitter", p.ovJitter);
+  optional_patch_from_json(j, "ovPin", p.ovPin);
+  optional_patch_from_json(j, "ovPort", p.ovPort);
+  optional_patch_from_json(j, "ovRenderAmbient", p.ovRenderAmbient);
+}
+
 inline void to_json(json &j, const Group &p) {
   j = json{{"_id", p._id}, {"stageId", p.stageId}, {"name", p.name}, {"description", p.description}, {"color", p.color},
            {"volume", p.volume}, {"muted", p.muted}, {"x", p.x}, {"y", p.y}, {"z", p.z}, {"rX", p.rX}, {"rY", p.rY},
@@ -589,6 +806,16 @@ inline void from_json(const json &j, Group &p) {
   from_json(j, static_cast<ThreeDimensionalProperties &>(p));
 }
 
+inline void patch_from_json(const json &j, Group &p) {
+  field_patch_from_json(j, "stageId", p.stageId);
+  field_patch_from_json(j, "name", p.name);
+  field_patch_from_json(j, "description", p.description);
+  field_patch_from_json(j, "color", p.color);
+  optional_patch_from_json(j, "iconUrl", p.iconUrl);
+  from_json(j, static_cast<VolumeProperties &>(p));
+  from_json(j, static_cast<ThreeDimensionalProperties &>(p));
+}
+
 inline void to_json(json &j, const CustomGroup &p) {
   j = json{{"_id", p._id},
            {"groupId", p.groupId},
@@ -614,6 +841,14 @@ inline void from_json(const json &j, CustomGroup &p) {
   from_json(j, static_cast<ThreeDimensionalProperties &>(p));
 }
 
+inline void patch_from_json(const json &j, CustomGroup &p) {
+  field_patch_from_json(j, "groupId", p.groupId);
+  field_patch_from_json(j, "targetGroupId", p.targetGroupId);
+  field_patch_from_json(j, "stageId", p.stageId);
+  from_json(j, static_cast<VolumeProperties &>(p));
+  from_json(j, static_cast<ThreeDimensionalProperties &>(p));
+}
+
 inline void to_json(json &j, const StageMember &p) {
   j = json{{"_id", p._id},
            {"stageId", p.stageId},
@@ -649,6 +884,17 @@ inline void from_json(const json &j, StageMember &p) {
   from_json(j, static_cast<ThreeDimensionalProperties &>(p));
 }
 
+inline void patch_from_json(const json &j, StageMember &p) {
+  field_patch_from_json(j, "stageId", p.stageId);
+  field_patch_from_json(j, "userId", p.userId);
+  field_patch_from_json(j, "active", p.active);
+  field_patch_from_json(j, "isDirector", p.isDirector);
+  field_patch_from_json(j, "name", p.name);
+  optional_patch_from_json(j, "groupId", p.groupId);
+  from_json(j, static_cast<VolumeProperties &>(p));
+  from_json(j, static_cast<ThreeDimensionalProperties &>(p));
+}
+
 inline void to_json(json &j, const StageDevice &p) {
   j = json{{"_id", p._id},
            {"userId", p.userId},
@@ -675,6 +921,18 @@ inline void from_json(const json &j, StageDevice &p) {
   optional_from_json(j, "groupId", p.groupId);
 }
 
+inline void patch_from_json(const json &j, StageDevice &p) {
+  field_patch_from_json(j, "userId", p.userId);
+  field_patch_from_json(j, "deviceId", p.deviceId);
+  field_patch_from_json(j, "stageId", p.stageId);
+  field_patch_from_json(j, "stageMemberId", p.stageMemberId);
+  field_patch_from_json(j, "active", p.active);
+  field_patch_from_json(j, "type", p.type);
+  field_patch_from_json(j, "order", p.order);
+  field_patch_from_json(j, "sendLocal", p.sendLocal);
+  optional_patch_from_json(j, "groupId", p.groupId);
+}
+
 inline void to_json(json &j, const Channel &p) {
   j = json{{"active", p.active}};
   optional_to_json(j, "label", p.label);
@@ -725,6 +983,25 @@ inline void from_json(const json &j, SoundCard &p) {
   optional_from_json(j, "softwareLatency", p.softwareLatency);
 }
 
+inline void patch_from_json(const json &j, SoundCard &p) {
+  field_patch_from_json(j, "uuid", p.uuid);
+  field_patch_from_json(j, "deviceId", p.deviceId);
+  field_patch_from_json(j, "audioEngine", p.audioEngine);
+  field_patch_from_json(j, "audioDriver", p.audioDriver);
+  field_patch_from_json(j, "type", p.type);
+  field_patch_from_json(j, "label", p.label);
+  field_patch_from_json(j, "sampleRate", p.sampleRate);
+  field_patch_from_json(j, "sampleRates", p.sampleRates);
+  field_patch_from_json(j, "bufferSize", p.bufferSize);
+  field_patch_from_json(j, "periodSize", p.periodSize);
+  field_patch_from_json(j, "numPeriods", p.numPeriods);
+  field_patch_from_json(j, "channels", p.channels);
+  field_patch_from_json(j, "online", p.online);
+  field_patch_from_json(j, "userId", p.userId);
+  optional_patch_from_json(j, "isDefault", p.isDefault);
+  optional_patch_from_json(j, "softwareLatency", p.softwareLatency);
+}
+
 inline void to_json(json &j, const VideoTrack &p) {
   j = json{{"_id", p._id},
            {"stageDeviceId", p.stageDeviceId},
@@ -745,6 +1022,15 @@ inline void from_json(const json &j, VideoTrack &p) {
   required_from_json(j, "type", p.type);
 }
 
+inline void patch_from_json(const json &j, VideoTrack &p) {
+  field_patch_from_json(j, "stageDeviceId", p.stageDeviceId);
+  field_patch_from_json(j, "stageMemberId", p.stageMemberId);
+  field_patch_from_json(j, "stageId", p.stageId);
+  field_patch_from_json(j, "deviceId", p.deviceId);
+  field_patch_from_json(j, "userId", p.userId);
+  field_patch_from_json(j, "type", p.type);
+}
+
 inline void to_json(json &j, const AudioTrack &p) {
   j = json{{"_id", p._id},
            {"stageDeviceId", p.stageDeviceId},
@@ -784,6 +1070,21 @@ inline void from_json(const json &j, AudioTrack &p) {
   from_json(j, static_cast<ThreeDimensionalProperties &>(p));
 }
 
+inline void patch_from_json(const json &j, AudioTrack &p) {
+  field_patch_from_json(j, "stageDeviceId", p.stageDeviceId);
+  field_patch_from_json(j, "stageMemberId", p.stageMemberId);
+  field_patch_from_json(j, "stageId", p.stageId);
+  field_patch_from_json(j, "deviceId", p.deviceId);
+  field_patch_from_json(j, "userId", p.userId);
+  field_patch_from_json(j, "type", p.type);
+  optional_patch_from_json(j, "name", p.name);
+  optional_patch_from_json(j, "sourceChannel", p.sourceChannel);
+  optional_patch_from_json(j, "ovSourcePort", p.ovSourcePort);
+  optional_patch_from_json(j, "uuid", p.uuid);
+  from_json(j, static_cast<VolumeProperties &>(p));
+  from_json(j, static_cast<ThreeDimensionalProperties &>(p));
+}
+
 inline void to_json(json &j, const User &p) {
   j = json{{"_id", p._id},
            {"uid", p.uid},
@@ -806,30 +1107,69 @@ inline void from_json(const json &j, User &p) {
   optional_from_json(j, "stageMemberId", p.stageMemberId);
 }
 
+inline void patch_from_json(const json &j, User &p) {
+  field_patch_from_json(j, "uid", p.uid);
+  field_patch_from_json(j, "name", p.name);
+  field_patch_from_json(j, "canCreateStage", p.canCreateStage);
+  optional_patch_from_json(j, "avatarUrl", p.avatarUrl);
+  optional_patch_from_json(j, "stageId", p.stageId);
+  optional_patch_from_json(j, "groupId", p.groupId);
+  optional_patch_from_json(j, "stageMemberId", p.stageMemberId);
+}
+
+/**
+ * Writes the entities as json object keyed by their ids
+ */
+template<class T>
+json entities_to_json(const std::map<ID_TYPE, T> &entities) {
+  json j = json::object();
+  for (const auto &entity: entities) {
+    j[entity.first.str()] = entity.second;
+  }
+  return j;
+}
+
+template<class T>
+void entities_from_json(const json &j, const std::string &key, std::map<ID_TYPE, T> &entities) {
+  if (!j.contains(key)) {
+    throw DigitalStage::Types::ParseException("Missing key '" + key + "'");
+  }
+  entities.clear();
+  for (const auto &entity: j.at(key).items()) {
+    T item;
+    try {
+      entity.value().get_to(item);
+    } catch (const nlohmann::json::exception &e) {
+      throw DigitalStage::Types::ParseException(key + ": " + e.what());
+    }
+    entities.emplace(ID_TYPE(entity.key()), std::move(item));
+  }
+}
+
 inline void to_json(json &j, const WholeStage &p) {
-  j = json{{"users", p.users},
-           {"devices", p.devices},
-           {"soundCards", p.soundCards},
-           {"stages", p.stages},
-           {"groups", p.groups},
-           {"groups", p.customGroups},
-           {"stageMembers", p.stageMembers},
-           {"stageDevices", p.stageDevices},
-           {"audioTracks", p.audioTracks},
-           {"videoTracks", p.videoTracks}};
+  j = json{{"users", entities_to_json(p.users)},
+           {"devices", entities_to_json(p.devices)},
+           {"soundCards", entities_to_json(p.soundCards)},
+           {"stages", entities_to_json(p.stages)},
+           {"groups", entities_to_json(p.groups)},
+           {"customGroups", entities_to_json(p.customGroups)},
+           {"stageMembers", entities_to_json(p.stageMembers)},
+           {"stageDevices", entities_to_json(p.stageDevices)},
+           {"audioTracks", entities_to_json(p.audioTracks)},
+           {"videoTracks", entities_to_json(p.videoTracks)}};
 }
 
 inline void from_json(const json &j, WholeStage &p) {
-  required_from_json(j, "users", p.users);
-  required_from_json(j, "devices", p.devices);
-  required_from_json(j, "soundCards", p.soundCards);
-  required_from_json(j, "stages", p.stages);
-  required_from_json(j, "groups", p.groups);
-  required_from_json(j, "customGroups", p.customGroups);
-  required_from_json(j, "stageMembers", p.stageMembers);
-  required_from_json(j, "stageDevices", p.stageDevices);
-  required_from_json(j, "audioTracks", p.audioTracks);
-  required_from_json(j, "videoTracks", p.videoTracks);
+  entities_from_json(j, "users", p.users);
+  entities_from_json(j, "devices", p.devices);
+  entities_from_json(j, "soundCards", p.soundCards);
+  entities_from_json(j, "stages", p.stages);
+  entities_from_json(j, "groups", p.groups);
+  entities_from_json(j, "customGroups", p.customGroups);
+  entities_from_json(j, "stageMembers", p.stageMembers);
+  entities_from_json(j, "stageDevices", p.stageDevices);
+  entities_from_json(j, "audioTracks", p.audioTracks);
+  entities_from_json(j, "videoTracks", p.videoTracks);
 }
 
 inline void to_json(json &j, const P2PRestart &p) {
@@ -899,4 +1239,11 @@ inline void from_json(const json &j, IceCandidate &p) {
 
 } // namespace DigitalStage::Types
 
+template<>
+struct std::hash<DigitalStage::Types::ObjectId> {
+  std::size_t operator()(const DigitalStage::Types::ObjectId &id) const noexcept {
+    return id.hash();
+  }
+};
+
 #endif
\ No newline at end of file
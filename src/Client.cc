@@ -10,6 +10,13 @@
 
 namespace DigitalStage::Api
 {
+    namespace
+    {
+        /**
+         * Event posted by the client itself on reconnect, so it is handled in order with the messages received before
+         */
+        const std::string RECONNECTED = "libds-reconnected";
+    } // namespace
 
     std::string describe_broken_json(nlohmann::json const& broken)
     {
@@ -29,20 +36,55 @@ namespace DigitalStage::Api
     Client::Client(std::string const & apiUrl) : apiUrl_(apiUrl)
     {
         store_ = std::make_unique<Store>();
+        weakStore_ = store_;
         wsclient_ = std::make_unique<teckos::client>();
         wsclient_->setShouldReconnect(true);
         wsclient_->setSendPayloadOnReconnect(true);
         wsclient_->setReconnectTrySleep(std::chrono::milliseconds(500)); // 500ms between tries for retry
+        batcher_ = std::make_unique<SendBatcher>(
+            [this](const std::string& event, const nlohmann::json& payload, SendBatcher::Callback callback) { wsclient_->send(event, payload, std::move(callback)); },
+            SendEvents::changeEvents(), SendEvents::signalingEvents());
+        registerBuiltinHandlers();
     }
 
     Client::~Client()
     {
+        // Stop dispatching first, so no handler sends or touches members while they are torn down
+        dispatcher_.reset();
         disconnect();
+        // Flush and destroy the batcher last, its sender uses the socket client
+        batcher_.reset();
+    }
+
+    void Client::enableDispatcher(EventDispatcher::Options options)
+    {
+        dispatcher_ = std::make_unique<EventDispatcher>([this](const std::string& event, const nlohmann::json& payload) { dispatch(event, payload); },
+                                                        options);
+    }
+
+    std::optional<EventDispatcher::Metrics> Client::getDispatcherMetrics() const
+    {
+        if (dispatcher_) {
+            return dispatcher_->metrics();
+        }
+        return std::nullopt;
+    }
+
+    void Client::dispatch(const std::string& event, const nlohmann::json& payload) noexcept
+    {
+        try {
+            handleMessage(event, payload);
+        } catch (const std::exception & e) {
+            spdlog::error("Libds caught exception in message handler handling {}, sending error signal: {}", event, e.what());
+            error(e);
+        } catch (...) {
+            spdlog::error("Libds caught unexpected exception in message handler handling {}, no further error handling possible.", event);
+        }
     }
 
     std::weak_ptr<Store> Client::getStore() const
     {
-        return this->store_;
+        return weakStore_;
     }
 
     void Client::disconnect()
@@ -65,7 +107,16 @@ namespace DigitalStage::Api
     {
         // Set handler
         wsclient_->on_disconnected([this](bool expected) { disconnected(expected); });
-        wsclient_->on_reconnected([]() { spdlog::info("Libds reconnected"); });
+        wsclient_->on_reconnected([this]() {
+            spdlog::info("Libds reconnected");
+            // Messages received before the reconnect may still be queued inside the dispatcher, they have to be applied first
+            if (dispatcher_) {
+                dispatcher_->post(RECONNECTED, nlohmann::json::object());
+            }
+            else {
+                dispatch(RECONNECTED, nlohmann::json::object());
+            }
+        });
         wsclient_->setMessageHandler([this](const nlohmann::json & json) {
             try {
                 if (!json.is_array()) {
@@ -73,9 +124,14 @@ namespace DigitalStage::Api
                     assert(false);
                     throw InvalidPayloadException("Response from server is invalid");
                 }
-                const std::string & event = json[0];
-                const nlohmann::json payload = (json.size() > 1) ? json[1] : nlohmann::json::object();
-                handleMessage(event, payload);
+                std::string event = json[0];
+                nlohmann::json payload = (json.size() > 1) ? json[1] : nlohmann::json::object();
+                if (dispatcher_) {
+                    dispatcher_->post(std::move(event), std::move(payload));
+                }
+                else {
+                    dispatch(event, payload);
+                }
             } catch (const std::exception & e) {
                 spdlog::error("Libds caught exception in message handler handling {}, sending error signal: {}", json.dump(), e.what());
                 error(e);
@@ -97,10 +153,10 @@ namespace DigitalStage::Api
         spdlog::debug("[SENDING] {}", event);
 #endif
 #endif
-        if (!wsclient_) {
+        if (!wsclient_ || !batcher_) {
             throw std::runtime_error("Libds not ready");
         }
-        wsclient_->send(event, message, [event, message](teckos::Result result) {
+        batcher_->send(event, message, [](const teckos::Result& result) {
             spdlog::debug("Got result from client, ignoring it: {}", result.size() > 0 ? result[0].dump() : "empty array");
         });
     }
@@ -114,10 +170,30 @@ namespace DigitalStage::Api
         spdlog::debug("[SENDING] {}", event);
 #endif
 #endif
-        if (!wsclient_) {
+        if (!wsclient_ || !batcher_) {
             throw std::runtime_error("Libds not ready");
         }
-        wsclient_->send(event, message, callback);
+        batcher_->send(event, message, std::move(callback));
+    }
+
+    void Client::beginBatch()
+    {
+        batcher_->begin();
+    }
+
+    void Client::commit()
+    {
+        batcher_->commit();
+    }
+
+    void Client::setSendBatchWindow(std::chrono::milliseconds window)
+    {
+        batcher_->setWindow(window);
+    }
+
+    SendBatcher::Metrics Client::getSendMetrics() const
+    {
+        return batcher_->metrics();
     }
 
     std::future<std::pair<std::string, std::optional<std::string>>> Client::decodeInvitationCode(const std::string & code)
@@ -286,7 +362,170 @@ namespace DigitalStage::Api
         }
     }
 
+    class Client::StageJoined {
+    public:
+        StageJoined(Client& client, std::string event) : client_(client), event_(std::move(event)) {}
+
+        /**
+         * Returns true, if the value of the key is an array of entities, which can be passed to add() one by one
+         */
+        static bool isList(const std::string& key)
+        {
+            return key == "remoteUsers" || key == "groups" || key == "customGroups" || key == "stageMembers" || key == "stageDevices" ||
+                   key == "audioTracks" || key == "videoTracks";
+        }
+
+        /**
+         * Parses a top level value of the payload, the order of keys does not matter
+         */
+        void set(const std::string& key, const nlohmann::json& value)
+        {
+            if (isList(key)) {
+                if (value.is_array()) {
+                    for (const auto& item : value) {
+                        add(key, item);
+                    }
+                } else if (!value.is_null()) {
+                    throw InvalidPayloadException("Expected an array for key " + key + " of event " + event_);
+                }
+            } else if (key == "stageId") {
+                stageId_ = parse<ID_TYPE>(value, event_, "stageId");
+            } else if (key == "stageMemberId") {
+                stageMemberId_ = parse<ID_TYPE>(value, event_, "stageMemberId");
+            } else if (key == "groupId") {
+                hasGroupId_ = true;
+                groupId_ = value.is_null() ? std::nullopt : std::optional<ID_TYPE>(parse<ID_TYPE>(value, event_, "groupId"));
+            } else if (key == "stage") {
+                stage_ = parse<Stage>(value, event_, "Stage");
+            }
+        }
+
+        /**
+         * Parses a single element of a list
+         */
+        void add(const std::string& key, const nlohmann::json& item)
+        {
+            if (key == "remoteUsers") {
+                users_.push_back(parse<User>(item, event_, "User"));
+            } else if (key == "groups") {
+                groups_.push_back(parse<Group>(item, event_, "Group"));
+            } else if (key == "customGroups") {
+                customGroups_.push_back(parse<CustomGroup>(item, event_, "CustomGroup"));
+            } else if (key == "stageMembers") {
+                stageMembers_.push_back(parse<StageMember>(item, event_, "StageMember"));
+            } else if (key == "stageDevices") {
+                stageDevices_.push_back(parse<StageDevice>(item, event_, "StageDevice"));
+            } else if (key == "audioTracks") {
+                audioTracks_.push_back(parse<AudioTrack>(item, event_, "AudioTrack"));
+            } else if (key == "videoTracks") {
+                videoTracks_.push_back(parse<VideoTrack>(item, event_, "VideoTrack"));
+            }
+        }
+
+        /**
+         * Commits the whole stage at once and notifies afterwards, so no observer sees a half loaded stage.
+         * The stage arena is only started once the whole payload has been validated, so an invalid payload leaves the store untouched.
+         */
+        void finish()
+        {
+            if (!stageId_) throw InvalidPayloadException("No stageId in payload of event " + event_);
+            if (!stageMemberId_) throw InvalidPayloadException("No stageMemberId in payload of event " + event_);
+            if (!hasGroupId_) throw InvalidPayloadException("No groupId in payload of event " + event_);
+            auto& store = *client_.store_;
+            // Each stage session gets a fresh arena, the one of a previous session is released with its last entity
+            store.beginStageArena();
+            auto transaction = store.transaction();
+            // Each item has been parsed once, the stored entities are shared with the signals emitted after commit
+            const auto users = createAll(transaction.users, users_);
+            const auto stage = stage_ ? transaction.stages.create(std::move(*stage_)) : nullptr;
+            const auto groups = createAll(transaction.groups, groups_);
+            const auto customGroups = createAll(transaction.customGroups, customGroups_);
+            const auto stageMembers = createAll(transaction.stageMembers, stageMembers_);
+            const auto stageDevices = createAll(transaction.stageDevices, stageDevices_);
+            const auto audioTracks = createAll(transaction.audioTracks, audioTracks_);
+            const auto videoTracks = createAll(transaction.videoTracks, videoTracks_);
+
+            const auto localDeviceId = store.getLocalDeviceId();
+            if (localDeviceId) {
+                for (const auto& stageDevice : stageDevices) {
+                    if (*stageId_ == stageDevice->stageId && *localDeviceId == stageDevice->deviceId) {
+                        store.setStageDeviceId(stageDevice->_id);
+                    }
+                }
+            }
+            store.setStageId(*stageId_);
+            store.setGroupId(groupId_);
+            store.setStageMemberId(*stageMemberId_);
+            transaction.commit();
+
+            for (const auto& user : users) {
+                client_.userAdded(*user, client_.weakStore_);
+            }
+            if (stage) {
+                client_.stageAdded(*stage, client_.weakStore_);
+            }
+            for (const auto& group : groups) {
+                client_.groupAdded(*group, client_.weakStore_);
+            }
+            for (const auto& customGroup : customGroups) {
+                client_.customGroupAdded(*customGroup, client_.weakStore_);
+            }
+            for (const auto& stageMember : stageMembers) {
+                client_.stageMemberAdded(*stageMember, client_.weakStore_);
+            }
+            for (const auto& stageDevice : stageDevices) {
+                client_.stageDeviceAdded(*stageDevice, client_.weakStore_);
+            }
+            for (const auto& audioTrack : audioTracks) {
+                client_.audioTrackAdded(*audioTrack, client_.weakStore_);
+            }
+            for (const auto& videoTrack : videoTracks) {
+                client_.videoTrackAdded(*videoTrack, client_.weakStore_);
+            }
+            client_.stageJoined(*stageId_, groupId_, client_.weakStore_);
+        }
+
+    private:
+        template <class T> static std::vector<std::shared_ptr<const T>> createAll(typename StoreEntry<T>::Batch& batch, std::vector<T>& items)
+        {
+            std::vector<std::shared_ptr<const T>> entities;
+            entities.reserve(items.size());
+            for (auto& item : items) {
+                entities.push_back(batch.create(std::move(item)));
+            }
+            return entities;
+        }
+
+        Client& client_;
+        const std::string event_;
+        std::optional<ID_TYPE> stageId_;
+        std::optional<ID_TYPE> stageMemberId_;
+        std::optional<ID_TYPE> groupId_;
+        bool hasGroupId_ = false;
+        std::vector<User> users_;
+        std::optional<Stage> stage_;
+        std::vector<Group> groups_;
+        std::vector<CustomGroup> customGroups_;
+        std::vector<StageMember> stageMembers_;
+        std::vector<StageDevice> stageDevices_;
+        std::vector<AudioTrack> audioTracks_;
+        std::vector<VideoTrack> videoTracks_;
+    };
+
     void Client::handleMessage(const std::string& event, const nlohmann::json& payload)
+    {
+        try {
+            handleEvent(event, payload);
+        }
+        catch (...) {
+            // Publish whatever has been applied before the failure, so snapshot readers stay in sync with the store
+            store_->publish();
+            throw;
+        }
+        store_->publish();
+    }
+
+    void Client::handleEvent(const std::string& event, const nlohmann::json& payload)
     {
 #ifdef DEBUG_EVENTS
 #ifdef DEBUG_PAYLOADS
@@ -295,7 +534,28 @@ namespace DigitalStage::Api
         spdlog::debug("[EVENT] {}", event);
 #endif
 #endif
-        if (event == RetrieveEvents::READY) {
+        auto handler = handlers_.find(event);
+        if (handler != handlers_.end()) {
+            handler->second(event, payload);
+        }
+    }
+
+    void Client::registerHandler(const std::string& event, EventHandler handler)
+    {
+        if (!handlers_.emplace(event, std::move(handler)).second) {
+            throw std::invalid_argument("There is already a handler registered for event " + event);
+        }
+    }
+
+    void Client::registerBuiltinHandlers()
+    {
+        registerHandler(RECONNECTED, [this](const std::string&, const nlohmann::json&) {
+            // The server sends the whole state again, everything it leaves out is purged on READY
+            store_->markUnconfirmed();
+        });
+        registerHandler(RetrieveEvents::READY, [this](const std::string&, const nlohmann::json& payload) {
+            // Remove cached or stale entities the server did not send again
+            store_->purgeUnconfirmed();
             store_->setReady(true);
             if (payload.contains("turn")) {
                 // TODO Is this optional or is it an error when these fields are missing? Missing verbosity!
@@ -303,149 +563,141 @@ namespace DigitalStage::Api
                 store_->setTurnUsername(payload["turn"]["username"]);
                 store_->setTurnPassword(payload["turn"]["credential"]);
             }
-            ready(getStore());
-        }
-        else if (event == RetrieveEvents::TURN_SERVERS_CHANGED) {
+            ready(weakStore_);
+        });
+        registerHandler(RetrieveEvents::TURN_SERVERS_CHANGED, [this](const std::string&, const nlohmann::json& payload) {
             store_->setTurnServers(payload);
             // TODO no signal sent
-        }
+        });
         /*
          * LOCAL DEVICE
          */
-        else if (event == RetrieveEvents::LOCAL_DEVICE_READY) {
-            const auto device = parse<Device>(payload, event, "Device");
-            store_->devices.create(payload);
-            store_->setLocalDeviceId(device._id);
-
-            deviceAdded(device, getStore());
-            localDeviceReady(device, getStore());
-            audioDriverSelected(device.audioDriver, getStore());
-            inputSoundCardSelected(device.inputSoundCardId, getStore());
-            outputSoundCardSelected(device.outputSoundCardId, getStore());
-        }
+        registerHandler(RetrieveEvents::LOCAL_DEVICE_READY, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto device = store_->devices.create(parse<Device>(payload, event, "Device"));
+            store_->setLocalDeviceId(device->_id);
+
+            deviceAdded(*device, weakStore_);
+            localDeviceReady(*device, weakStore_);
+            audioDriverSelected(device->audioDriver, weakStore_);
+            inputSoundCardSelected(device->inputSoundCardId, weakStore_);
+            outputSoundCardSelected(device->outputSoundCardId, weakStore_);
+        });
         /*
          * LOCAL USER
          */
-        else if (event == RetrieveEvents::USER_READY) {
-            const auto user = parse<User>(payload, event, "User");
-            store_->users.create(payload);
-            store_->setUserId(user._id);
+        registerHandler(RetrieveEvents::USER_READY, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto user = store_->users.create(parse<User>(payload, event, "User"));
+            store_->setUserId(user->_id);
 
-            userAdded(user, getStore());
-            localUserReady(user, getStore());
-        }
+            userAdded(*user, weakStore_);
+            localUserReady(*user, weakStore_);
+        });
         /*
          * DEVICES
          */
-        else if (event == RetrieveEvents::DEVICE_ADDED) {
-            const auto device = parse<Device>(payload, event, "Device");
-            store_->devices.create(payload);
+        registerHandler(RetrieveEvents::DEVICE_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto device = store_->devices.create(parse<Device>(payload, event, "Device"));
 
-            deviceAdded(device, getStore());
-        }
-        else if (event == RetrieveEvents::DEVICE_CHANGED) {
-            store_->devices.update(payload);
+            deviceAdded(*device, weakStore_);
+        });
+        registerHandler(RetrieveEvents::DEVICE_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto device = store_->devices.update(payload);
             const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-            deviceChanged(id, payload, getStore());
+            deviceChanged(id, payload, weakStore_);
             auto localDeviceIdPtr = store_->getLocalDeviceId();
-            if (localDeviceIdPtr && *localDeviceIdPtr == id) {
-                auto device = store_->devices.get(id);
-                localDeviceChanged(id, payload, getStore());
+            if (device && localDeviceIdPtr && *localDeviceIdPtr == id) {
+                localDeviceChanged(id, payload, weakStore_);
                 if (payload.count("audioDriver") != 0) {
-                    audioDriverSelected(device->audioDriver, getStore());
+                    audioDriverSelected(device->audioDriver, weakStore_);
                 }
                 if (payload.count("inputSoundCardId") != 0) {
-                    inputSoundCardSelected(device->inputSoundCardId, getStore());
+                    inputSoundCardSelected(device->inputSoundCardId, weakStore_);
                 }
                 if (payload.count("outputSoundCardId") != 0) {
-                    outputSoundCardSelected(device->outputSoundCardId, getStore());
+                    outputSoundCardSelected(device->outputSoundCardId, weakStore_);
                 }
             }
-        }
-        else if (event == RetrieveEvents::DEVICE_REMOVED) {
+        });
+        registerHandler(RetrieveEvents::DEVICE_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
             store_->devices.remove(id);
-            deviceRemoved(id, getStore());
-        }
+            deviceRemoved(id, weakStore_);
+        });
         /*
          * STAGE
          */
-        else if (event == RetrieveEvents::STAGE_ADDED) {
-            const auto stage = parse<Stage>(payload, event, "Stage");
-            store_->stages.create(payload);
+        registerHandler(RetrieveEvents::STAGE_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto stage = store_->stages.create(parse<Stage>(payload, event, "Stage"));
 
-            stageAdded(stage, getStore());
-        }
-        else if (event == RetrieveEvents::STAGE_CHANGED) {
+            stageAdded(*stage, weakStore_);
+        });
+        registerHandler(RetrieveEvents::STAGE_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->stages.update(payload);
-            const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-
-            stageChanged(id, payload, getStore());
-        }
-        else if (event == RetrieveEvents::STAGE_REMOVED) {
+            if (stageChanged.slot_count() > 0) {
+                stageChanged(parseKey<ID_TYPE>(payload, "_id", event), payload, weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::STAGE_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
             store_->stages.remove(id);
 
-            stageRemoved(id, getStore());
-        }
+            stageRemoved(id, weakStore_);
+        });
         /*
          * GROUPS
          */
-        else if (event == RetrieveEvents::GROUP_ADDED) {
-            const auto group = parse<Group>(payload, event, "Group");
-            store_->groups.create(payload);
+        registerHandler(RetrieveEvents::GROUP_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto group = store_->groups.create(parse<Group>(payload, event, "Group"));
 
-            groupAdded(group, getStore());
-        }
-        else if (event == RetrieveEvents::GROUP_CHANGED) {
+            groupAdded(*group, weakStore_);
+        });
+        registerHandler(RetrieveEvents::GROUP_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->groups.update(payload);
-            const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-
-            groupChanged(id, payload, getStore());
-        }
-        else if (event == RetrieveEvents::GROUP_REMOVED) {
+            if (groupChanged.slot_count() > 0) {
+                groupChanged(parseKey<ID_TYPE>(payload, "_id", event), payload, weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::GROUP_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
             store_->groups.remove(id);
 
-            groupRemoved(id, getStore());
-        }
+            groupRemoved(id, weakStore_);
+        });
         /*
          * CUSTOM GROUP
          */
-        else if (event == RetrieveEvents::CUSTOM_GROUP_ADDED) {
-            const auto customGroup = parse<CustomGroup>(payload, event, "CustomGroup");
-            store_->customGroups.create(payload);
+        registerHandler(RetrieveEvents::CUSTOM_GROUP_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto customGroup = store_->customGroups.create(parse<CustomGroup>(payload, event, "CustomGroup"));
 
-            customGroupAdded(customGroup, getStore());
-        }
-        else if (event == RetrieveEvents::CUSTOM_GROUP_CHANGED) {
+            customGroupAdded(*customGroup, weakStore_);
+        });
+        registerHandler(RetrieveEvents::CUSTOM_GROUP_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->customGroups.update(payload);
-            const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-
-            customGroupChanged(id, payload, getStore());
-        }
-        else if (event == RetrieveEvents::CUSTOM_GROUP_REMOVED) {
+            if (customGroupChanged.slot_count() > 0) {
+                customGroupChanged(parseKey<ID_TYPE>(payload, "_id", event), payload, weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::CUSTOM_GROUP_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
-            auto custom_group = store_->customGroups.get(id);
+            auto custom_group = store_->customGroups.getShared(id);
             if (custom_group) {
                 store_->customGroups.remove(id);
-                customGroupRemoved(*custom_group, getStore());
+                customGroupRemoved(*custom_group, weakStore_);
             }
-        }
+        });
         /*
          * STAGE MEMBERS
          */
-        else if (event == RetrieveEvents::STAGE_MEMBER_ADDED) {
-            const auto stage_member = parse<StageMember>(payload, event, "StageMember");
-            store_->stageMembers.create(payload);
+        registerHandler(RetrieveEvents::STAGE_MEMBER_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto stage_member = store_->stageMembers.create(parse<StageMember>(payload, event, "StageMember"));
 
-            stageMemberAdded(stage_member, getStore());
-        }
-        else if (event == RetrieveEvents::STAGE_MEMBER_CHANGED) {
+            stageMemberAdded(*stage_member, weakStore_);
+        });
+        registerHandler(RetrieveEvents::STAGE_MEMBER_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->stageMembers.update(payload);
             const auto id = parseKey<ID_TYPE>(payload, "_id", event);
 
-            stageMemberChanged(id, payload, getStore());
+            stageMemberChanged(id, payload, weakStore_);
             if (id == store_->getStageMemberId()) {
                 if (payload.count("groupId") != 0) {
                     if (payload["groupId"].is_null()) {
@@ -456,36 +708,35 @@ namespace DigitalStage::Api
                     }
                 }
             }
-        }
-        else if (event == RetrieveEvents::STAGE_MEMBER_REMOVED) {
+        });
+        registerHandler(RetrieveEvents::STAGE_MEMBER_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
             store_->stageMembers.remove(id);
 
-            stageMemberRemoved(id, getStore());
-        }
+            stageMemberRemoved(id, weakStore_);
+        });
         /*
          * STAGE DEVICES
          */
-        else if (event == RetrieveEvents::STAGE_DEVICE_ADDED) {
-            const auto stageDevice = parse<StageDevice>(payload, event, "StageDevice");
-            store_->stageDevices.create(payload);
+        registerHandler(RetrieveEvents::STAGE_DEVICE_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto stageDevice = store_->stageDevices.create(parse<StageDevice>(payload, event, "StageDevice"));
             auto localDeviceId = store_->getLocalDeviceId();
             auto stageId = store_->getStageId();
-            if (localDeviceId && stageId && *stageId == stageDevice.stageId && *localDeviceId == stageDevice.deviceId) {
-                store_->setStageDeviceId(stageDevice._id);
+            if (localDeviceId && stageId && *stageId == stageDevice->stageId && *localDeviceId == stageDevice->deviceId) {
+                store_->setStageDeviceId(stageDevice->_id);
             }
 
-            stageDeviceAdded(stageDevice, getStore());
-        }
-        else if (event == RetrieveEvents::STAGE_DEVICE_CHANGED) {
+            stageDeviceAdded(*stageDevice, weakStore_);
+        });
+        registerHandler(RetrieveEvents::STAGE_DEVICE_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->stageDevices.update(payload);
-            const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-
-            stageDeviceChanged(id, payload, getStore());
-        }
-        else if (event == RetrieveEvents::STAGE_DEVICE_REMOVED) {
+            if (stageDeviceChanged.slot_count() > 0) {
+                stageDeviceChanged(parseKey<ID_TYPE>(payload, "_id", event), payload, weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::STAGE_DEVICE_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
-            auto stageDevice = store_->stageDevices.get(id);
+            auto stageDevice = store_->stageDevices.getShared(id);
             if (stageDevice) {
                 store_->stageDevices.remove(id);
                 auto stageId = store_->getStageId();
@@ -494,205 +745,159 @@ namespace DigitalStage::Api
                     store_->resetStageDeviceId();
                 }
 
-                stageDeviceRemoved(*stageDevice, getStore());
+                stageDeviceRemoved(*stageDevice, weakStore_);
             }
-        }
+        });
         /*
          * VIDEO TRACKS
          */
-        else if (event == RetrieveEvents::VIDEO_TRACK_ADDED) {
-            const auto videoTrack = parse<VideoTrack>(payload, event, "VideoTrack");
-            store_->videoTracks.create(payload);
+        registerHandler(RetrieveEvents::VIDEO_TRACK_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto videoTrack = store_->videoTracks.create(parse<VideoTrack>(payload, event, "VideoTrack"));
 
-            videoTrackAdded(videoTrack, getStore());
-        }
-        else if (event == RetrieveEvents::VIDEO_TRACK_CHANGED) {
+            videoTrackAdded(*videoTrack, weakStore_);
+        });
+        registerHandler(RetrieveEvents::VIDEO_TRACK_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->videoTracks.update(payload);
-            const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-
-            videoTrackChanged(id, payload, getStore());
-        }
-        else if (event == RetrieveEvents::VIDEO_TRACK_REMOVED) {
+            if (videoTrackChanged.slot_count() > 0) {
+                videoTrackChanged(parseKey<ID_TYPE>(payload, "_id", event), payload, weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::VIDEO_TRACK_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
-            auto track = store_->videoTracks.get(id);
-            store_->videoTracks.remove(id);
-
-            videoTrackRemoved(*track, getStore());
-        }
+            auto track = store_->videoTracks.getShared(id);
+            if (track) {
+                store_->videoTracks.remove(id);
+                videoTrackRemoved(*track, weakStore_);
+            }
+        });
         /*
          * AUDIO TRACKS
          */
-        else if (event == RetrieveEvents::AUDIO_TRACK_ADDED) {
-            const auto audioTrack = parse<AudioTrack>(payload, event, "AudioTrack");
-            store_->audioTracks.create(payload);
+        registerHandler(RetrieveEvents::AUDIO_TRACK_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto audioTrack = store_->audioTracks.create(parse<AudioTrack>(payload, event, "AudioTrack"));
 
-            audioTrackAdded(audioTrack, getStore());
-        }
-        else if (event == RetrieveEvents::AUDIO_TRACK_CHANGED) {
+            audioTrackAdded(*audioTrack, weakStore_);
+        });
+        registerHandler(RetrieveEvents::AUDIO_TRACK_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->audioTracks.update(payload);
-            const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-
-            audioTrackChanged(id, payload, getStore());
-        }
-        else if (event == RetrieveEvents::AUDIO_TRACK_REMOVED) {
+            if (audioTrackChanged.slot_count() > 0) {
+                audioTrackChanged(parseKey<ID_TYPE>(payload, "_id", event), payload, weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::AUDIO_TRACK_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
-            auto track = store_->audioTracks.get(id);
-            if (track.has_value()) {
+            auto track = store_->audioTracks.getShared(id);
+            if (track) {
                 store_->audioTracks.remove(id);
-                audioTrackRemoved(*track, getStore());
+                audioTrackRemoved(*track, weakStore_);
             }
             else {
-                spdlog::warn("Ignoring AUDIO_TRACK_REMOVED message as track with ID is no longer known: {}", id);
+                spdlog::warn("Ignoring AUDIO_TRACK_REMOVED message as track with ID is no longer known: {}", id.str());
             }
-        }
+        });
         /*
          * USERS
          */
-        else if (event == RetrieveEvents::USER_ADDED) {
-            const auto user = parse<User>(payload, event, "User");
-            store_->users.create(payload);
+        registerHandler(RetrieveEvents::USER_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto user = store_->users.create(parse<User>(payload, event, "User"));
 
-            userAdded(user, getStore());
-        }
-        else if (event == RetrieveEvents::USER_CHANGED) {
+            userAdded(*user, weakStore_);
+        });
+        registerHandler(RetrieveEvents::USER_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->users.update(payload);
-            const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-
-            userChanged(id, payload, getStore());
-        }
-        else if (event == RetrieveEvents::USER_REMOVED) {
-            const auto id = parse<ID_TYPE>(payload, event, "id");
-            store_->users.remove(id);
+            if (userChanged.slot_count() > 0) {
+                userChanged(parseKey<ID_TYPE>(payload, "_id", event), payload, weakStore_);
+            }
+        });
+        // USER_REMOVED is sent with the same name as USER_READY, which always took precedence
+        if (RetrieveEvents::USER_REMOVED != RetrieveEvents::USER_READY) {
+            registerHandler(RetrieveEvents::USER_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
+                const auto id = parse<ID_TYPE>(payload, event, "id");
+                store_->users.remove(id);
 
-            userRemoved(id, getStore());
+                userRemoved(id, weakStore_);
+            });
         }
         /*
          * SOUND CARD
          */
-        else if (event == RetrieveEvents::SOUND_CARD_ADDED) {
-            const auto soundCard = parse<SoundCard>(payload, event, "SoundCard");
-            store_->soundCards.create(payload);
+        registerHandler(RetrieveEvents::SOUND_CARD_ADDED, [this](const std::string& event, const nlohmann::json& payload) {
+            const auto soundCard = store_->soundCards.create(parse<SoundCard>(payload, event, "SoundCard"));
 
-            soundCardAdded(soundCard, getStore());
-        }
-        else if (event == RetrieveEvents::SOUND_CARD_CHANGED) {
+            soundCardAdded(*soundCard, weakStore_);
+        });
+        registerHandler(RetrieveEvents::SOUND_CARD_CHANGED, [this](const std::string& event, const nlohmann::json& payload) {
             store_->soundCards.update(payload);
             const auto id = parseKey<ID_TYPE>(payload, "_id", event);
-            soundCardChanged(id, payload, getStore());
+            soundCardChanged(id, payload, weakStore_);
             auto localDevice = store_->getLocalDevice();
             if (localDevice) {
                 if (localDevice->inputSoundCardId == id) {
-                    inputSoundCardChanged(id, payload, getStore());
+                    inputSoundCardChanged(id, payload, weakStore_);
                 }
                 if (localDevice->outputSoundCardId == id) {
-                    outputSoundCardChanged(id, payload, getStore());
+                    outputSoundCardChanged(id, payload, weakStore_);
                 }
             }
-        }
-        else if (event == RetrieveEvents::SOUND_CARD_REMOVED) {
+        });
+        registerHandler(RetrieveEvents::SOUND_CARD_REMOVED, [this](const std::string& event, const nlohmann::json& payload) {
             const auto id = parse<ID_TYPE>(payload, event, "id");
             store_->soundCards.remove(id);
 
-            soundCardRemoved(id, getStore());
-        }
+            soundCardRemoved(id, weakStore_);
+        });
         /*
          * STAGE JOINED
          */
-        else if (event == RetrieveEvents::STAGE_JOINED) {
-            auto stageId = parseKey<std::string>(payload, "stageId", event);
-            auto stageMemberId = parseKey<std::string>(payload, "stageMemberId", event);
-            if (!payload.contains("groupId")) throw InvalidPayloadException("No groupId in payload of event " + event);
-            auto groupId = payload["groupId"].is_null() ? std::nullopt : std::optional<std::string>(parseKey<std::string>(payload, "groupId", event));
-            auto localDeviceId = store_->getLocalDeviceId();
-            if (payload.count("remoteUsers") > 0) {
-                for (const auto& item : payload["remoteUsers"]) {
-                    const auto user = parse<User>(item, event, "User");
-                    store_->users.create(item);
-                    userAdded(user, getStore());
-                }
-            }
-            if (payload.count("stage") > 0) {
-                const auto stage = parse<Stage>(payload["stage"], event, "Stage");
-                store_->stages.create(payload["stage"]);
-                stageAdded(stage, getStore());
+        registerHandler(RetrieveEvents::STAGE_JOINED, [this](const std::string& event, const nlohmann::json& payload) {
+            if (!payload.is_object()) throw InvalidPayloadException("Payload of event " + event + " is not an object");
+            StageJoined joined(*this, event);
+            for (auto it = payload.begin(); it != payload.end(); ++it) {
+                joined.set(it.key(), it.value());
             }
-            if (payload.count("groups") > 0) {
-                for (const auto& item : payload["groups"]) {
-                    const auto group = parse<Group>(item, event, "Group");
-                    store_->groups.create(item);
-                    groupAdded(group, getStore());
-                }
-            }
-            if (payload.contains("customGroups")) {
-                for (const auto& item : payload["customGroups"]) {
-                    const auto customGroup = parse<CustomGroup>(item, event, "CustomGroup");
-                    store_->customGroups.create(item);
-                    customGroupAdded(customGroup, getStore());
-                }
-            }
-            for (const auto& item : payload["stageMembers"]) {
-                const auto stage_member = parse<StageMember>(item, event, "StageMember");
-                store_->stageMembers.create(item);
-                stageMemberAdded(stage_member, getStore());
-            }
-            for (const auto& item : payload["stageDevices"]) {
-                const auto stageDevice = parse<StageDevice>(item, event, "StageDevice");
-                store_->stageDevices.create(item);
-                if (localDeviceId && stageId == stageDevice.stageId && *localDeviceId == stageDevice.deviceId) {
-                    store_->setStageDeviceId(stageDevice._id);
-                }
-                stageDeviceAdded(stageDevice, getStore());
-            }
-            for (const auto& item : payload["audioTracks"]) {
-                const auto audioTrack = parse<AudioTrack>(item, event, "AudioTrack");
-                store_->audioTracks.create(item);
-                audioTrackAdded(audioTrack, getStore());
-            }
-            for (const auto& item : payload["videoTracks"]) {
-                const auto videoTrack = parse<VideoTrack>(item, event, "VideoTrack");
-                store_->videoTracks.create(item);
-                videoTrackAdded(videoTrack, getStore());
-            }
-            store_->setStageId(stageId);
-            store_->setGroupId(groupId);
-            store_->setStageMemberId(stageMemberId);
-            stageJoined(stageId, groupId, getStore());
-        }
+            joined.finish();
+        });
         /*
          * STAGE LEFT
          */
-        else if (event == RetrieveEvents::STAGE_LEFT) {
+        registerHandler(RetrieveEvents::STAGE_LEFT, [this](const std::string&, const nlohmann::json&) {
             store_->resetStageId();
             store_->resetGroupId();
             store_->resetStageMemberId();
             store_->resetStageDeviceId();
             store_->stageMembers.removeAll();
+            store_->stageDevices.removeAll();
             store_->customGroups.removeAll();
             store_->videoTracks.removeAll();
             store_->audioTracks.removeAll();
+            store_->endStageArena();
             // TODO: Discuss, the store may dispatch all the events instead...
             // TODO: Otherwise we have to dispatch all removals HERE (!)
             // Current workaround: assuming, that on left all using
             // components know, that the entities are removed without event
-            stageLeft(getStore());
-        }
+            stageLeft(weakStore_);
+        });
         // WebRTC
-        else if (event == RetrieveEvents::P2P_RESTART) {
-            const auto item = parse<P2PRestart>(payload, event, "P2PRestart");
-            p2pRestart(item, getStore());
-        }
-        else if (event == RetrieveEvents::P2P_OFFER_SENT) {
-            const auto item = parse<P2POffer>(payload, event, "P2POffer");
-            p2pOffer(item, getStore());
-        }
-        else if (event == RetrieveEvents::P2P_ANSWER_SENT) {
-            const auto item = parse<P2PAnswer>(payload, event, "P2PAnswer");
-            p2pAnswer(item, getStore());
-        }
-        else if (event == RetrieveEvents::ICE_CANDIDATE_SENT) {
-            const auto item = parse<IceCandidate>(payload, event, "IceCandidate");
-            iceCandidate(item, getStore());
-        }
+        registerHandler(RetrieveEvents::P2P_RESTART, [this](const std::string& event, const nlohmann::json& payload) {
+            if (p2pRestart.slot_count() > 0) {
+                p2pRestart(parse<P2PRestart>(payload, event, "P2PRestart"), weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::P2P_OFFER_SENT, [this](const std::string& event, const nlohmann::json& payload) {
+            if (p2pOffer.slot_count() > 0) {
+                p2pOffer(parse<P2POffer>(payload, event, "P2POffer"), weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::P2P_ANSWER_SENT, [this](const std::string& event, const nlohmann::json& payload) {
+            if (p2pAnswer.slot_count() > 0) {
+                p2pAnswer(parse<P2PAnswer>(payload, event, "P2PAnswer"), weakStore_);
+            }
+        });
+        registerHandler(RetrieveEvents::ICE_CANDIDATE_SENT, [this](const std::string& event, const nlohmann::json& payload) {
+            if (iceCandidate.slot_count() > 0) {
+                iceCandidate(parse<IceCandidate>(payload, event, "IceCandidate"), weakStore_);
+            }
+        });
     }
 
 } // namespace DigitalStage::Api
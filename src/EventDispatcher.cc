@@ -0,0 +1,188 @@
+#include "DigitalStage/Api/EventDispatcher.h"
+
+#include "spdlog/spdlog.h"
+
+using namespace DigitalStage::Api;
+
+namespace {
+/**
+ * Time the dispatcher thread sleeps at most, before it checks the queue again without being woken up
+ */
+constexpr std::chrono::milliseconds kIdleTimeout(100);
+
+void storeMax(std::atomic<std::int64_t> &target, std::int64_t value) {
+  auto current = target.load(std::memory_order_relaxed);
+  while (current < value && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+}
+}
+
+EventDispatcher::EventDispatcher(Handler handler, Options options)
+    : handler_(std::move(handler)),
+      overflow_(options.overflow),
+      coalesce_(std::move(options.coalesce)),
+      coalesceWindow_(options.coalesceWindow),
+      queue_(options.capacity),
+      thread_(&EventDispatcher::run, this) {
+}
+
+EventDispatcher::~EventDispatcher() {
+  running_ = false;
+  wakeUp();
+  {
+    std::lock_guard<std::mutex> lock(room_mutex_);
+    room_.notify_all();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool EventDispatcher::post(std::string event, nlohmann::json payload) {
+  Message message{std::move(event), std::move(payload), std::chrono::steady_clock::now()};
+  auto popped = popped_.load();
+  while (!queue_.tryPush(std::move(message))) {
+    if (overflow_ == OverflowPolicy::DropNewest) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      spdlog::warn("Event queue is full, dropping event {}", message.event);
+      return false;
+    }
+    if (overflow_ == OverflowPolicy::DropOldest) {
+      Message oldest;
+      if (queue_.tryPop(oldest)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        spdlog::warn("Event queue is full, dropping event {}", oldest.event);
+      }
+      continue;
+    }
+    // Block until the dispatcher thread popped an event since the queue was seen full
+    std::unique_lock<std::mutex> lock(room_mutex_);
+    blocked_.fetch_add(1);
+    wakeUp();
+    room_.wait(lock, [this, popped] { return !running_ || popped_.load() != popped; });
+    blocked_.fetch_sub(1);
+    if (!running_) {
+      return false;
+    }
+    popped = popped_.load();
+  }
+  recordDepth();
+  wakeUp();
+  return true;
+}
+
+EventDispatcher::Metrics EventDispatcher::metrics() const {
+  Metrics metrics;
+  metrics.depth = queue_.size();
+  metrics.peakDepth = peakDepth_.load(std::memory_order_relaxed);
+  metrics.dispatched = dispatched_.load(std::memory_order_relaxed);
+  metrics.dropped = dropped_.load(std::memory_order_relaxed);
+  metrics.coalesced = coalesced_.load(std::memory_order_relaxed);
+  metrics.lastWait = std::chrono::microseconds(lastWait_.load(std::memory_order_relaxed));
+  metrics.maxWait = std::chrono::microseconds(maxWait_.load(std::memory_order_relaxed));
+  metrics.totalWait = std::chrono::microseconds(totalWait_.load(std::memory_order_relaxed));
+  return metrics;
+}
+
+void EventDispatcher::recordDepth() {
+  const auto depth = queue_.size();
+  auto peak = peakDepth_.load(std::memory_order_relaxed);
+  while (peak < depth && !peakDepth_.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {
+  }
+}
+
+void EventDispatcher::wakeUp() {
+  // Notify under the lock, the dispatcher thread checks the queue under it right before waiting,
+  // so it either sees the pushed event or is already waiting when notified
+  std::lock_guard<std::mutex> lock(wake_mutex_);
+  wake_.notify_one();
+}
+
+void EventDispatcher::madeRoom() {
+  // Counting the pop before checking for blocked producers pairs with post(), which registers before checking the count
+  popped_.fetch_add(1);
+  if (blocked_.load() > 0) {
+    std::lock_guard<std::mutex> lock(room_mutex_);
+    room_.notify_all();
+  }
+}
+
+void EventDispatcher::run() {
+  Message message;
+  while (running_) {
+    if (queue_.tryPop(message)) {
+      madeRoom();
+      if (!coalesce(message)) {
+        // Keep the order of events, an entity may e.g. be removed right after it has been changed
+        flushPending();
+        handle(message);
+      }
+      if (!pending_.empty() && coalesceWindow_.count() > 0 && std::chrono::steady_clock::now() - pendingSince_ >= coalesceWindow_) {
+        flushPending();
+      }
+      // Release the payload right away instead of keeping it until the next event
+      message = Message();
+      continue;
+    }
+    auto timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(kIdleTimeout);
+    if (!pending_.empty()) {
+      const auto pendingFor = std::chrono::steady_clock::now() - pendingSince_;
+      if (pendingFor >= coalesceWindow_) {
+        flushPending();
+        continue;
+      }
+      timeout = coalesceWindow_ - pendingFor;
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_.wait_for(lock, timeout, [this] { return !running_ || !queue_.empty(); });
+  }
+}
+
+bool EventDispatcher::coalesce(Message &message) {
+  if (coalesce_.count(message.event) == 0 || !message.payload.is_object()) {
+    return false;
+  }
+  const auto id = message.payload.find("_id");
+  if (id == message.payload.end() || !id->is_string()) {
+    return false;
+  }
+  std::string key = message.event;
+  key += '\0';
+  key += id->get_ref<const std::string &>();
+  const auto it = pendingIndex_.find(key);
+  if (it != pendingIndex_.end()) {
+    // Later values win, like applying both patches one after another
+    pending_[it->second].payload.update(message.payload);
+    coalesced_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  if (pending_.empty()) {
+    pendingSince_ = message.received;
+  }
+  pendingIndex_.emplace(key, pending_.size());
+  pending_.push_back(std::move(message));
+  return true;
+}
+
+void EventDispatcher::flushPending() {
+  for (auto &message: pending_) {
+    handle(message);
+  }
+  pending_.clear();
+  pendingIndex_.clear();
+}
+
+void EventDispatcher::handle(Message &message) {
+  const auto wait = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - message.received).count();
+  lastWait_.store(wait, std::memory_order_relaxed);
+  storeMax(maxWait_, wait);
+  totalWait_.fetch_add(wait, std::memory_order_relaxed);
+  try {
+    handler_(message.event, message.payload);
+  } catch (const std::exception &e) {
+    spdlog::error("Uncaught exception while dispatching event {}: {}", message.event, e.what());
+  } catch (...) {
+    spdlog::error("Uncaught exception while dispatching event {}", message.event);
+  }
+  dispatched_.fetch_add(1, std::memory_order_relaxed);
+}
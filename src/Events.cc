@@ -68,4 +68,17 @@ const std::string RetrieveEvents::P2P_ANSWER_SENT = "p2p-a";
 const std::string RetrieveEvents::ICE_CANDIDATE_SENT = "ice";
 const std::string RetrieveEvents::TURN_SERVERS_CHANGED = "t";
 
+std::set<std::string> SendEvents::changeEvents() {
+  return {CHANGE_DEVICE, CHANGE_SOUND_CARD, CHANGE_AUDIO_TRACK, CHANGE_STAGE, CHANGE_GROUP};
+}
+
+std::set<std::string> SendEvents::signalingEvents() {
+  return {SEND_P2P_RESTART, SEND_P2P_OFFER, SEND_P2P_ANSWER, SEND_ICE_CANDIDATE};
+}
+
+std::set<std::string> RetrieveEvents::changeEvents() {
+  return {DEVICE_CHANGED, STAGE_CHANGED, USER_CHANGED, GROUP_CHANGED, CUSTOM_GROUP_CHANGED, STAGE_MEMBER_CHANGED,
+          STAGE_DEVICE_CHANGED, VIDEO_TRACK_CHANGED, AUDIO_TRACK_CHANGED, SOUND_CARD_CHANGED};
+}
+
 } // namespace DigitalStage::Api
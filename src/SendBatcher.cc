@@ -0,0 +1,307 @@
+#include "DigitalStage/Api/SendBatcher.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "spdlog/spdlog.h"
+
+using namespace DigitalStage::Api;
+
+class SendBatcher::Sending {
+public:
+  explicit Sending(SendBatcher &batcher) : batcher_(batcher), owns_(true) {
+    batcher_.send_mutex_.lock();
+    batcher_.senders_++;
+  }
+
+  Sending(SendBatcher &batcher, std::try_to_lock_t) : batcher_(batcher), owns_(batcher.send_mutex_.try_lock()) {
+    if (owns_) {
+      batcher_.senders_++;
+    }
+  }
+
+  ~Sending() {
+    if (owns_) {
+      batcher_.senders_--;
+      batcher_.send_mutex_.unlock();
+      // Priority messages may have been queued, while this thread was sending
+      batcher_.sendPriority();
+    }
+  }
+
+  Sending(const Sending &) = delete;
+  Sending &operator=(const Sending &) = delete;
+
+  bool owns() const {
+    return owns_;
+  }
+
+private:
+  SendBatcher &batcher_;
+  const bool owns_;
+};
+
+SendBatcher::SendBatcher(Sender sender, std::set<std::string> merge, std::set<std::string> priority)
+    : sender_(std::move(sender)), merge_(std::move(merge)), priority_(std::move(priority)) {
+}
+
+SendBatcher::~SendBatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  wake_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  flush();
+}
+
+void SendBatcher::setWindow(std::chrono::milliseconds window) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_ = window;
+    // The thread is only needed once a window has been set
+    if (window_.count() > 0 && !thread_.joinable()) {
+      thread_ = std::thread(&SendBatcher::run, this);
+    }
+  }
+  wake_.notify_all();
+  if (window.count() == 0) {
+    flush();
+  }
+}
+
+void SendBatcher::begin() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  depth_++;
+}
+
+void SendBatcher::commit() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (depth_ == 0) {
+      spdlog::warn("Committing a batch, which has not been started");
+      return;
+    }
+    if (--depth_ > 0 || window_.count() > 0) {
+      // The window thread sends the messages, when the window elapsed
+      wake_.notify_all();
+      return;
+    }
+  }
+  flush();
+}
+
+void SendBatcher::send(const std::string &event, const nlohmann::json &payload, Callback callback) {
+  const auto now = std::chrono::steady_clock::now();
+  if (priority_.count(event) > 0) {
+    {
+      Sending sending(*this, std::try_to_lock);
+      if (sending.owns()) {
+        // Nobody else is sending, so the message is passed on right away
+        sendQueuedPriority();
+        recordSent(metrics_.priority, now);
+        sender_(event, payload, std::move(callback));
+        return;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      prioritized_.push_back({event, payload, {}, now});
+      prioritized_.back().callbacks.push_back(std::move(callback));
+      recordDepth(metrics_.priority, prioritized_.size());
+    }
+    sendPriority();
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (depth_ == 0 && window_.count() == 0) {
+    lock.unlock();
+    Sending sending(*this);
+    sendQueuedPriority();
+    recordSent(metrics_.bulk, now);
+    sender_(event, payload, std::move(callback));
+    return;
+  }
+  const auto id = merge_.count(event) > 0 && payload.is_object() ? payload.find("_id") : payload.end();
+  if (id != payload.end() && id->is_string()) {
+    std::string key = event;
+    key += '\0';
+    key += id->get_ref<const std::string &>();
+    const auto it = pendingIndex_.find(key);
+    if (it != pendingIndex_.end()) {
+      // Later values win, like applying both patches one after another
+      auto &message = pending_[it->second];
+      message.payload.update(payload);
+      message.callbacks.push_back(std::move(callback));
+      merged_++;
+      return;
+    }
+    pendingIndex_.emplace(key, pending_.size());
+  } else {
+    // Keep the order of messages, an entity may e.g. be removed right after it has been changed
+    pendingIndex_.clear();
+  }
+  if (pending_.empty()) {
+    pendingSince_ = now;
+    wake_.notify_all();
+  }
+  pending_.push_back({event, payload, {}, now});
+  pending_.back().callbacks.push_back(std::move(callback));
+  recordDepth(metrics_.bulk, pending_.size() + inFlight_);
+}
+
+void SendBatcher::flush() {
+  Sending sending(*this);
+  sendAll(takePending());
+}
+
+std::uint64_t SendBatcher::merged() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return merged_;
+}
+
+SendBatcher::Metrics SendBatcher::metrics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Metrics metrics = metrics_;
+  metrics.priority.depth = prioritized_.size();
+  metrics.bulk.depth = pending_.size() + inFlight_;
+  return metrics;
+}
+
+void SendBatcher::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    if (pending_.empty() || depth_ > 0 || window_.count() == 0) {
+      wake_.wait(lock);
+      continue;
+    }
+    const auto deadline = pendingSince_ + window_;
+    if (std::chrono::steady_clock::now() < deadline) {
+      wake_.wait_until(lock, deadline);
+      continue;
+    }
+    // Take the locks in the same order as flush()
+    lock.unlock();
+    {
+      Sending sending(*this);
+      std::vector<Message> messages;
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        // A batch opened in between decides on its own when to send
+        if (depth_ == 0) {
+          std::swap(messages, pending_);
+          pendingIndex_.clear();
+          inFlight_ += messages.size();
+        }
+      }
+      sendAll(std::move(messages));
+    }
+    lock.lock();
+  }
+}
+
+std::vector<SendBatcher::Message> SendBatcher::takePending() {
+  std::vector<Message> messages;
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::swap(messages, pending_);
+  pendingIndex_.clear();
+  inFlight_ += messages.size();
+  return messages;
+}
+
+void SendBatcher::sendAll(std::vector<Message> messages) {
+  for (auto &message: messages) {
+    // Priority messages queued meanwhile overtake the remaining bulk messages
+    sendQueuedPriority();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      inFlight_--;
+    }
+    sendMessage(message, metrics_.bulk);
+  }
+}
+
+void SendBatcher::sendPriority() {
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (prioritized_.empty()) {
+        return;
+      }
+    }
+    if (!send_mutex_.try_lock()) {
+      if (senders_.load() > 0) {
+        // The sending thread passes the messages on before its next message or right after it has finished
+        return;
+      }
+      // try_lock may fail spuriously, nobody else would send the queued messages then
+      std::this_thread::yield();
+      continue;
+    }
+    senders_++;
+    sendQueuedPriority();
+    senders_--;
+    send_mutex_.unlock();
+  }
+}
+
+void SendBatcher::sendQueuedPriority() {
+  for (;;) {
+    Message message;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (prioritized_.empty()) {
+        return;
+      }
+      message = std::move(prioritized_.front());
+      prioritized_.pop_front();
+    }
+    sendMessage(message, metrics_.priority);
+  }
+}
+
+void SendBatcher::sendMessage(Message &message, LaneMetrics &lane) {
+  Callback callback;
+  if (message.callbacks.size() == 1) {
+    callback = std::move(message.callbacks.front());
+  } else {
+    // Shared, so the sender gets a cheap copy and the callbacks are still at hand if sending fails
+    callback = [callbacks = std::make_shared<std::vector<Callback>>(std::move(message.callbacks))](const std::vector<nlohmann::json> &result) {
+      for (const auto &callback: *callbacks) {
+        if (callback) {
+          callback(result);
+        }
+      }
+    };
+  }
+  recordSent(lane, message.queued);
+  try {
+    sender_(message.event, message.payload, callback);
+  } catch (const std::exception &e) {
+    spdlog::error("Could not send queued message {}: {}", message.event, e.what());
+    // Nobody else reports the failure, so resolve every merged message with the error instead of leaving it pending
+    if (callback) {
+      try {
+        callback({nlohmann::json(std::string("Could not send message: ") + e.what())});
+      } catch (const std::exception &callbackError) {
+        spdlog::error("Callback of unsent message {} failed: {}", message.event, callbackError.what());
+      }
+    }
+  }
+}
+
+void SendBatcher::recordSent(LaneMetrics &lane, std::chrono::steady_clock::time_point queued) {
+  const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - queued);
+  std::lock_guard<std::mutex> lock(mutex_);
+  lane.sent++;
+  lane.lastLatency = latency;
+  lane.maxLatency = std::max(lane.maxLatency, latency);
+  lane.totalLatency += latency;
+}
+
+void SendBatcher::recordDepth(LaneMetrics &lane, std::size_t depth) {
+  lane.peakDepth = std::max(lane.peakDepth, depth);
+}
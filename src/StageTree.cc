@@ -0,0 +1,157 @@
+#include "DigitalStage/Api/StageTree.h"
+
+using namespace DigitalStage::Api;
+
+std::vector<StageTree::Handle> StageTree::stages() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<Handle> handles;
+  // Stages are ordered first, since the nodes are sorted by level
+  for (auto it = nodes_.begin(); it != nodes_.end() && it->first.level == Level::Stage; ++it) {
+    if (it->second.exists) {
+      handles.push_back(it->first);
+    }
+  }
+  return handles;
+}
+
+std::vector<StageTree::Handle> StageTree::children(const Handle &node) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<Handle> handles;
+  auto it = nodes_.find(node);
+  if (it != nodes_.end()) {
+    for (const auto &child: it->second.children) {
+      if (nodes_.at(child).exists) {
+        handles.push_back(child);
+      }
+    }
+  }
+  return handles;
+}
+
+std::optional<StageTree::Handle> StageTree::parent(const Handle &node) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = nodes_.find(node);
+  if (it != nodes_.end() && it->second.exists) {
+    return it->second.parent;
+  }
+  return std::nullopt;
+}
+
+bool StageTree::contains(const Handle &node) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = nodes_.find(node);
+  return it != nodes_.end() && it->second.exists;
+}
+
+void StageTree::set(const Handle &node, const std::optional<Handle> &parent) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto &entry = nodes_[node];
+  if (entry.parent != parent) {
+    detachLocked(node, entry);
+    if (parent) {
+      // The parent may not be known yet, so this creates a placeholder if necessary
+      nodes_[*parent].children.insert(node);
+      dirty_.insert(*parent);
+    }
+    entry.parent = parent;
+  }
+  entry.exists = true;
+  dirty_.insert(node);
+}
+
+void StageTree::erase(const Handle &node) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  eraseLocked(node);
+}
+
+void StageTree::clear(Level level) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  std::vector<Handle> handles;
+  // Nodes are sorted by level first
+  for (auto it = nodes_.lower_bound({level, {}}); it != nodes_.end() && it->first.level == level; ++it) {
+    if (it->second.exists) {
+      handles.push_back(it->first);
+    }
+  }
+  for (const auto &handle: handles) {
+    eraseLocked(handle);
+  }
+}
+
+void StageTree::eraseLocked(const Handle &node) {
+  auto it = nodes_.find(node);
+  if (it == nodes_.end() || !it->second.exists) {
+    return;
+  }
+  // Report the removal by the parent, only stages are reported by themselves
+  if (it->second.parent) {
+    dirty_.erase(node);
+    dirty_.insert(*it->second.parent);
+  }
+  else {
+    dirty_.insert(node);
+  }
+  it->second.exists = false;
+  if (it->second.children.empty()) {
+    detachLocked(node, it->second);
+    nodes_.erase(it);
+  }
+  // Otherwise keep a placeholder, the children are still referencing it
+}
+
+void StageTree::detachLocked(const Handle &node, Node &entry) {
+  if (!entry.parent) {
+    return;
+  }
+  const auto parent = *entry.parent;
+  entry.parent.reset();
+  auto parentEntry = nodes_.find(parent);
+  if (parentEntry != nodes_.end()) {
+    parentEntry->second.children.erase(node);
+    dirty_.insert(parent);
+    eraseIfUnusedLocked(parent);
+  }
+}
+
+void StageTree::eraseIfUnusedLocked(const Handle &node) {
+  auto it = nodes_.find(node);
+  if (it != nodes_.end() && !it->second.exists && it->second.children.empty()) {
+    auto parent = it->second.parent;
+    if (parent) {
+      // The parent has been marked when this node has been removed
+      dirty_.erase(node);
+    }
+    nodes_.erase(it);
+    if (parent) {
+      auto parentEntry = nodes_.find(*parent);
+      if (parentEntry != nodes_.end()) {
+        parentEntry->second.children.erase(node);
+        eraseIfUnusedLocked(*parent);
+      }
+    }
+  }
+}
+
+void StageTree::notify() {
+  std::set<Handle> roots;
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (dirty_.empty()) {
+      return;
+    }
+    // Only report the top-most dirty nodes, their subtrees contain all other changes
+    for (const auto &handle: dirty_) {
+      bool covered = false;
+      auto it = nodes_.find(handle);
+      while (!covered && it != nodes_.end() && it->second.parent) {
+        covered = dirty_.count(*it->second.parent) > 0;
+        it = nodes_.find(*it->second.parent);
+      }
+      if (!covered) {
+        roots.insert(handle);
+      }
+    }
+    dirty_.clear();
+  }
+  dirty(roots);
+}
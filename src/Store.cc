@@ -1,11 +1,429 @@
-
 #include "DigitalStage/Api/Store.h"
 
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
 using namespace DigitalStage::Api;
 using namespace DigitalStage::Types;
 
+namespace {
+/**
+ * Appends an unambiguous key out of multiple values by prefixing each part with its length
+ */
+void appendCompositeKey(std::string &key, std::initializer_list<std::string_view> parts) {
+  for (const auto &part: parts) {
+    char length[20];
+    const auto end = std::to_chars(length, length + sizeof(length), part.size()).ptr;
+    key.append(length, end);
+    key += ':';
+    key += part;
+  }
+}
+
+std::string compositeKey(std::initializer_list<std::string_view> parts) {
+  std::string key;
+  appendCompositeKey(key, parts);
+  return key;
+}
+
+/**
+ * Builds a composite key to look up, inside a buffer reused by the calling thread.
+ * The view is valid until the next call on the same thread, lookups do not allocate once the buffer has grown.
+ */
+std::string_view compositeLookupKey(std::initializer_list<std::string_view> parts) {
+  thread_local std::string buffer;
+  buffer.clear();
+  appendCompositeKey(buffer, parts);
+  return buffer;
+}
+
+/**
+ * Index key of an id, which is its raw binary form
+ */
+std::optional<std::string> idKey(const ID_TYPE &id) {
+  return std::string(id.bytes());
+}
+
+std::optional<std::string> idKey(const std::optional<ID_TYPE> &id) {
+  if (id) {
+    return idKey(*id);
+  }
+  return std::nullopt;
+}
+
+/**
+ * Version of the cache file format written by Store::save, increase it on incompatible changes
+ */
+constexpr int kCacheVersion = 1;
+
+template<class T>
+std::map<ID_TYPE, T> collect(const StoreEntry<T> &entry) {
+  std::map<ID_TYPE, T> items;
+  entry.forEach([&](const T &item) { items.emplace(item._id, item); });
+  return items;
+}
+
+template<class T>
+void createAll(typename StoreEntry<T>::Batch &batch, const nlohmann::json &items) {
+  for (const auto &item: items) {
+    batch.create(item);
+  }
+}
+
+/**
+ * Reads an optional id of the cache
+ * @throws ParseException if the id is present but malformed
+ */
+void getIfPresent(const nlohmann::json &j, const std::string &key, std::optional<ID_TYPE> &id) {
+  auto it = j.find(key);
+  if (it != j.end()) {
+    id = it->get<ID_TYPE>();
+  }
+}
+
+void setIfPresent(nlohmann::json &j, const std::string &key, const std::optional<ID_TYPE> &id) {
+  if (id) {
+    j[key] = *id;
+  }
+}
+}
+
 Store::Store()
-    : isReady_(false) {}
+    : isReady_(false) {
+  // Foreign key indexes used by the relationship queries below
+  groups.addIndex("stageId", [](const Group &group) { return idKey(group.stageId); });
+  stageMembers.addIndex("stageId", [](const StageMember &stageMember) { return idKey(stageMember.stageId); });
+  stageMembers.addIndex("groupId", [](const StageMember &stageMember) { return idKey(stageMember.groupId); });
+  stageDevices.addIndex("stageMemberId", [](const StageDevice &stageDevice) { return idKey(stageDevice.stageMemberId); });
+  videoTracks.addIndex("stageDeviceId", [](const VideoTrack &videoTrack) { return idKey(videoTrack.stageDeviceId); });
+  audioTracks.addIndex("stageDeviceId", [](const AudioTrack &audioTrack) { return idKey(audioTrack.stageDeviceId); });
+  audioTracks.addIndex("stageMemberId", [](const AudioTrack &audioTrack) { return idKey(audioTrack.stageMemberId); });
+  audioTracks.addIndex("deviceId", [](const AudioTrack &audioTrack) { return idKey(audioTrack.deviceId); });
+  // Unique indexes
+  audioTracks.addIndex("uuid", [](const AudioTrack &audioTrack) { return audioTrack.uuid; });
+  customGroups.addIndex("groupId+targetGroupId", [](const CustomGroup &customGroup) {
+    return std::optional<std::string>(compositeKey({customGroup.groupId.bytes(), customGroup.targetGroupId.bytes()}));
+  });
+  soundCards.addIndex("deviceId+audioDriver+type+label", [](const SoundCard &soundCard) {
+    return std::optional<std::string>(compositeKey({soundCard.deviceId.bytes(), soundCard.audioDriver, soundCard.type, soundCard.label}));
+  });
+  publish();
+}
+
+WholeStage Store::getWholeStage() const {
+  WholeStage wholeStage;
+  wholeStage.users = collect(users);
+  wholeStage.devices = collect(devices);
+  wholeStage.soundCards = collect(soundCards);
+  wholeStage.stages = collect(stages);
+  wholeStage.groups = collect(groups);
+  wholeStage.customGroups = collect(customGroups);
+  wholeStage.stageMembers = collect(stageMembers);
+  wholeStage.stageDevices = collect(stageDevices);
+  wholeStage.audioTracks = collect(audioTracks);
+  wholeStage.videoTracks = collect(videoTracks);
+  return wholeStage;
+}
+
+bool Store::save(const std::string &path) const {
+  nlohmann::json cache = {{"version", kCacheVersion}, {"state", getWholeStage()}};
+  setIfPresent(cache, "localDeviceId", getLocalDeviceId());
+  setIfPresent(cache, "userId", getUserId());
+  setIfPresent(cache, "stageId", getStageId());
+  setIfPresent(cache, "stageMemberId", getStageMemberId());
+  setIfPresent(cache, "groupId", getGroupId());
+  setIfPresent(cache, "stageDeviceId", getStageDeviceId());
+  const auto data = nlohmann::json::to_cbor(cache);
+
+  const auto temporaryPath = path + ".tmp";
+  {
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!file) {
+      spdlog::error("Could not write store cache to {}", temporaryPath);
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  if (error) {
+    spdlog::error("Could not replace store cache {}: {}", path, error.message());
+    return false;
+  }
+  return true;
+}
+
+bool Store::load(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    spdlog::info("No store cache found at {}", path);
+    return false;
+  }
+  const std::vector<std::uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  nlohmann::json cache;
+  try {
+    cache = nlohmann::json::from_cbor(data);
+    if (cache.at("version").get<int>() != kCacheVersion) {
+      spdlog::warn("Ignoring store cache {} of another format version", path);
+      return false;
+    }
+  } catch (const nlohmann::json::exception &e) {
+    spdlog::warn("Ignoring corrupted store cache {}: {}", path, e.what());
+    return false;
+  }
+
+  auto transaction = this->transaction();
+  std::optional<ID_TYPE> localDeviceId, userId, stageId, stageMemberId, groupId, stageDeviceId;
+  try {
+    const auto &state = cache.at("state");
+    createAll<User>(transaction.users, state.at("users"));
+    createAll<Device>(transaction.devices, state.at("devices"));
+    createAll<SoundCard>(transaction.soundCards, state.at("soundCards"));
+    createAll<Stage>(transaction.stages, state.at("stages"));
+    createAll<Group>(transaction.groups, state.at("groups"));
+    createAll<CustomGroup>(transaction.customGroups, state.at("customGroups"));
+    createAll<StageMember>(transaction.stageMembers, state.at("stageMembers"));
+    createAll<StageDevice>(transaction.stageDevices, state.at("stageDevices"));
+    createAll<AudioTrack>(transaction.audioTracks, state.at("audioTracks"));
+    createAll<VideoTrack>(transaction.videoTracks, state.at("videoTracks"));
+    getIfPresent(cache, "localDeviceId", localDeviceId);
+    getIfPresent(cache, "userId", userId);
+    getIfPresent(cache, "stageId", stageId);
+    if (stageId) {
+      getIfPresent(cache, "stageMemberId", stageMemberId);
+      getIfPresent(cache, "groupId", groupId);
+      getIfPresent(cache, "stageDeviceId", stageDeviceId);
+    }
+  } catch (const nlohmann::json::exception &e) {
+    spdlog::warn("Ignoring corrupted store cache {}: {}", path, e.what());
+    return false;
+  } catch (const ParseException &e) {
+    spdlog::warn("Ignoring corrupted store cache {}: {}", path, e.what());
+    return false;
+  }
+
+  // The ids are only restored along with the entities, so a corrupted cache leaves the store untouched
+  transaction.commit();
+  if (localDeviceId) {
+    setLocalDeviceId(*localDeviceId);
+  }
+  if (userId) {
+    setUserId(*userId);
+  }
+  if (stageId) {
+    setStageId(*stageId);
+    if (stageMemberId) {
+      setStageMemberId(*stageMemberId);
+    }
+    if (groupId) {
+      setGroupId(*groupId);
+    }
+    if (stageDeviceId) {
+      setStageDeviceId(*stageDeviceId);
+    }
+  }
+  markUnconfirmed();
+  return true;
+}
+
+void Store::markUnconfirmed() {
+  devices.markUnconfirmed();
+  users.markUnconfirmed();
+  stages.markUnconfirmed();
+  groups.markUnconfirmed();
+  stageMembers.markUnconfirmed();
+  stageDevices.markUnconfirmed();
+  videoTracks.markUnconfirmed();
+  audioTracks.markUnconfirmed();
+  customGroups.markUnconfirmed();
+  soundCards.markUnconfirmed();
+  stageUnconfirmed_ = stageId_.has_value();
+}
+
+void Store::purgeUnconfirmed() {
+  // Remove dependent entities first
+  videoTracks.purgeUnconfirmed();
+  audioTracks.purgeUnconfirmed();
+  stageDevices.purgeUnconfirmed();
+  stageMembers.purgeUnconfirmed();
+  customGroups.purgeUnconfirmed();
+  groups.purgeUnconfirmed();
+  stages.purgeUnconfirmed();
+  soundCards.purgeUnconfirmed();
+  devices.purgeUnconfirmed();
+  users.purgeUnconfirmed();
+  if (stageUnconfirmed_.exchange(false)) {
+    resetStageId();
+    resetGroupId();
+    resetStageMemberId();
+    resetStageDeviceId();
+  }
+}
+
+std::shared_ptr<const Store::Snapshot> Store::snapshot() const noexcept {
+  return std::atomic_load(&snapshot_);
+}
+
+void Store::publish() {
+  // One publish at a time, so snapshots, the stage tree and the notifications follow the order of the changes
+  std::lock_guard<std::recursive_mutex> publishing(publish_mutex_);
+  auto snapshot = std::make_shared<Snapshot>();
+  ChangeSet changes;
+  snapshot->devices = devices.publish(changes.devices);
+  snapshot->users = users.publish(changes.users);
+  snapshot->stages = stages.publish(changes.stages);
+  snapshot->groups = groups.publish(changes.groups);
+  snapshot->stageMembers = stageMembers.publish(changes.stageMembers);
+  snapshot->stageDevices = stageDevices.publish(changes.stageDevices);
+  snapshot->videoTracks = videoTracks.publish(changes.videoTracks);
+  snapshot->audioTracks = audioTracks.publish(changes.audioTracks);
+  snapshot->customGroups = customGroups.publish(changes.customGroups);
+  snapshot->soundCards = soundCards.publish(changes.soundCards);
+  snapshot->localDeviceId = localDeviceId_.get();
+  snapshot->userId = userId_.get();
+  snapshot->stageId = stageId_.get();
+  snapshot->stageMemberId = stageMemberId_.get();
+  snapshot->groupId = groupId_.get();
+  snapshot->stageDeviceId = stageDeviceId_.get();
+  std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(snapshot)));
+  if (!changes.empty()) {
+    updateStageTree(changes);
+    changed(changes);
+    stageTree.notify();
+  }
+
+  bool reportMemoryUsage = false;
+  {
+    std::lock_guard<std::mutex> lock(memory_report_mutex_);
+    const auto now = std::chrono::steady_clock::now();
+    if (memoryReportInterval_.count() > 0 && now - lastMemoryReport_ >= memoryReportInterval_) {
+      lastMemoryReport_ = now;
+      reportMemoryUsage = true;
+    }
+  }
+  if (reportMemoryUsage) {
+    memoryUsageReported(memoryUsage());
+  }
+}
+
+template<class T, class ParentOf>
+void Store::updateStageTree(const StoreEntry<T> &entry,
+                            const StoreChanges &changes,
+                            StageTree::Level level,
+                            ParentOf parentOf) {
+  if (changes.cleared) {
+    stageTree.clear(level);
+  }
+  for (const auto &id: changes.removed) {
+    stageTree.erase({level, id});
+  }
+  for (const auto *ids: {&changes.added, &changes.changed}) {
+    for (const auto &id: *ids) {
+      if (auto item = entry.getShared(id)) {
+        stageTree.set({level, id}, parentOf(*item));
+      }
+    }
+  }
+}
+
+void Store::updateStageTree(const ChangeSet &changes) {
+  using Level = StageTree::Level;
+  // Parents are inserted before their children, so children do not need placeholders
+  updateStageTree(stages, changes.stages, Level::Stage, [](const Stage &) {
+    return std::optional<StageTree::Handle>();
+  });
+  updateStageTree(groups, changes.groups, Level::Group, [](const Group &group) {
+    return std::optional<StageTree::Handle>({Level::Stage, group.stageId});
+  });
+  updateStageTree(stageMembers, changes.stageMembers, Level::StageMember, [](const StageMember &stageMember) {
+    return std::optional<StageTree::Handle>(stageMember.groupId
+                                            ? StageTree::Handle{Level::Group, *stageMember.groupId}
+                                            : StageTree::Handle{Level::Stage, stageMember.stageId});
+  });
+  updateStageTree(stageDevices, changes.stageDevices, Level::StageDevice, [](const StageDevice &stageDevice) {
+    return std::optional<StageTree::Handle>({Level::StageMember, stageDevice.stageMemberId});
+  });
+  updateStageTree(audioTracks, changes.audioTracks, Level::AudioTrack, [](const AudioTrack &audioTrack) {
+    return std::optional<StageTree::Handle>({Level::StageDevice, audioTrack.stageDeviceId});
+  });
+  updateStageTree(videoTracks, changes.videoTracks, Level::VideoTrack, [](const VideoTrack &videoTrack) {
+    return std::optional<StageTree::Handle>({Level::StageDevice, videoTrack.stageDeviceId});
+  });
+}
+
+void Store::beginStageArena() {
+  auto arena = std::make_shared<StageArena>();
+  stageMembers.setArena(arena);
+  stageDevices.setArena(arena);
+  audioTracks.setArena(arena);
+  videoTracks.setArena(arena);
+  customGroups.setArena(arena);
+}
+
+void Store::endStageArena() {
+  stageMembers.setArena(nullptr);
+  stageDevices.setArena(nullptr);
+  audioTracks.setArena(nullptr);
+  videoTracks.setArena(nullptr);
+  customGroups.setArena(nullptr);
+}
+
+Store::MemoryUsage Store::memoryUsage() const {
+  MemoryUsage usage;
+  usage.devices = devices.memoryUsage();
+  usage.users = users.memoryUsage();
+  usage.stages = stages.memoryUsage();
+  usage.groups = groups.memoryUsage();
+  usage.stageMembers = stageMembers.memoryUsage();
+  usage.stageDevices = stageDevices.memoryUsage();
+  usage.videoTracks = videoTracks.memoryUsage();
+  usage.audioTracks = audioTracks.memoryUsage();
+  usage.customGroups = customGroups.memoryUsage();
+  usage.soundCards = soundCards.memoryUsage();
+  for (const auto *collection: {&usage.devices, &usage.users, &usage.stages, &usage.groups, &usage.stageMembers,
+                                &usage.stageDevices, &usage.videoTracks, &usage.audioTracks, &usage.customGroups,
+                                &usage.soundCards}) {
+    usage.entities += collection->entities;
+    usage.bytes += collection->bytes;
+  }
+  auto peak = peakBytes_.load();
+  while (peak < usage.bytes && !peakBytes_.compare_exchange_weak(peak, usage.bytes)) {
+  }
+  usage.peakBytes = std::max(peak, usage.bytes);
+  return usage;
+}
+
+void Store::setMemoryUsageReportInterval(std::chrono::milliseconds interval) {
+  std::lock_guard<std::mutex> lock(memory_report_mutex_);
+  memoryReportInterval_ = interval;
+  lastMemoryReport_ = std::chrono::steady_clock::now();
+}
+
+bool Store::ChangeSet::empty() const {
+  return devices.empty() && users.empty() && stages.empty() && groups.empty() && stageMembers.empty() &&
+      stageDevices.empty() && videoTracks.empty() && audioTracks.empty() && customGroups.empty() && soundCards.empty();
+}
+
+Store::Transaction Store::transaction() {
+  return Transaction(*this);
+}
+
+void Store::Transaction::commit() {
+  store_.devices.apply(devices);
+  store_.users.apply(users);
+  store_.stages.apply(stages);
+  store_.groups.apply(groups);
+  store_.stageMembers.apply(stageMembers);
+  store_.stageDevices.apply(stageDevices);
+  store_.videoTracks.apply(videoTracks);
+  store_.audioTracks.apply(audioTracks);
+  store_.customGroups.apply(customGroups);
+  store_.soundCards.apply(soundCards);
+  store_.publish();
+}
 
 std::optional<Device> Store::getLocalDevice() const {
   if (localDeviceId_.has_value()) {
@@ -71,10 +489,12 @@ std::optional<DigitalStage::Types::Stage> Store::getStage() const {
 
 void Store::setStageId(const ID_TYPE &id) {
   stageId_.set(id);
+  stageUnconfirmed_ = false;
 }
 
 void Store::resetStageId() {
   stageId_.set(std::nullopt);
+  stageUnconfirmed_ = false;
 }
 
 std::optional<ID_TYPE> Store::getGroupId() const {
@@ -94,90 +514,44 @@ void Store::resetStageMemberId() {
 }
 
 std::vector<Group> Store::getGroupsByStage(const ID_TYPE &stageId) const {
-  auto vector = std::vector<Group>();
-  for (const auto &item: groups.getAll()) {
-    if (item.stageId == stageId) {
-      vector.push_back(item);
-    }
-  }
-  return vector;
+  return groups.getAllBy("stageId", stageId);
 }
 
 [[maybe_unused]] std::vector<StageMember>
 Store::getStageMembersByStage(const ID_TYPE &stageId) const {
-  auto vector = std::vector<StageMember>();
-  for (const auto &item: stageMembers.getAll()) {
-    if (item.stageId == stageId) {
-      vector.push_back(item);
-    }
-  }
-  return vector;
+  return stageMembers.getAllBy("stageId", stageId);
 }
 
 std::vector<StageMember>
 Store::getStageMembersByGroup(const ID_TYPE &groupId) const {
-  auto vector = std::vector<StageMember>();
-  for (const auto &item: stageMembers.getAll()) {
-    if (item.groupId == groupId) {
-      vector.push_back(item);
-    }
-  }
-  return vector;
+  return stageMembers.getAllBy("groupId", groupId);
 }
 
 std::optional<CustomGroup>
 Store::getCustomGroupByGroupAndTargetGroup(const ID_TYPE &groupId,
                                               const ID_TYPE &targetGroupId) const {
-  for (const auto &item: customGroups.getAll()) {
-    if (item.groupId == groupId && item.targetGroupId == targetGroupId) {
-      return item;
-    }
-  }
-  return std::nullopt;
+  return customGroups.getBy("groupId+targetGroupId", compositeLookupKey({groupId.bytes(), targetGroupId.bytes()}));
 }
 
 std::vector<VideoTrack>
 Store::getVideoTracksByStageDevice(const ID_TYPE &stageDeviceId) const {
-  auto vector = std::vector<VideoTrack>();
-  for (const auto &item: videoTracks.getAll()) {
-    if (item.stageDeviceId == stageDeviceId) {
-      vector.push_back(item);
-    }
-  }
-  return vector;
+  return videoTracks.getAllBy("stageDeviceId", stageDeviceId);
 }
 
 std::vector<AudioTrack>
 Store::getAudioTracksByStageDevice(const ID_TYPE &stageDeviceId) const {
-  auto vector = std::vector<AudioTrack>();
-  for (const auto &item: audioTracks.getAll()) {
-    if (item.stageDeviceId == stageDeviceId) {
-      vector.push_back(item);
-    }
-  }
-  return vector;
+  return audioTracks.getAllBy("stageDeviceId", stageDeviceId);
 }
 
 std::vector<AudioTrack>
 Store::getAudioTracksByStageMember(const ID_TYPE &stageMemberId) const {
-  auto vector = std::vector<AudioTrack>();
-  for (const auto &audioTrack: audioTracks.getAll()) {
-    if (audioTrack.stageMemberId == stageMemberId) {
-      vector.push_back(audioTrack);
-    }
-  }
-  return vector;
+  return audioTracks.getAllBy("stageMemberId", stageMemberId);
 }
 
 std::optional<DigitalStage::Types::AudioTrack>
-Store::getAudioTrackByUuid(const ID_TYPE & uuid) const
+Store::getAudioTrackByUuid(const std::string &uuid) const
 {
-    for (const auto & audioTrack : this->audioTracks.getAll()) {
-        if (audioTrack.uuid == uuid) {
-            return audioTrack;
-        }
-    }
-    return {};
+    return audioTracks.getBy("uuid", uuid);
 }
 
 
@@ -204,26 +578,12 @@ Store::getSoundCardByDeviceAndDriverAndTypeAndLabel(const ID_TYPE &deviceId,
                                                     const std::string &audioDriver,
                                                     const std::string &type,
                                                     const std::string &label) const {
-  for (const auto &item: soundCards.getAll()) {
-    if (item.deviceId == deviceId &&
-        item.audioDriver == audioDriver &&
-        item.type == type &&
-        item.label == label) {
-      return item;
-    }
-  }
-  return std::nullopt;
+  return soundCards.getBy("deviceId+audioDriver+type+label", compositeLookupKey({deviceId.bytes(), audioDriver, type, label}));
 }
 
 std::vector<DigitalStage::Types::StageDevice>
 Store::getStageDevicesByStageMember(const ID_TYPE &stageMemberId) const {
-  auto vector = std::vector<StageDevice>();
-  for (const auto &item: stageDevices.getAll()) {
-    if (item.stageMemberId == stageMemberId) {
-      vector.push_back(item);
-    }
-  }
-  return vector;
+  return stageDevices.getAllBy("stageMemberId", stageMemberId);
 }
 
 std::optional<DigitalStage::Types::SoundCard> Store::getInputSoundCard() const {
@@ -242,16 +602,11 @@ std::optional<DigitalStage::Types::SoundCard> Store::getOutputSoundCard() const
   return std::nullopt;
 }
 std::vector<DigitalStage::Types::AudioTrack> Store::getLocalAudioTracks() const {
-  auto vector = std::vector<AudioTrack>();
   auto localDeviceId = getLocalDeviceId();
   if (localDeviceId) {
-    for (const auto &item: this->audioTracks.getAll()) {
-      if (item.deviceId == *localDeviceId) {
-        vector.push_back(item);
-      }
-    }
+    return audioTracks.getAllBy("deviceId", *localDeviceId);
   }
-  return vector;
+  return {};
 }
 
 std::vector<std::string> Store::getTurnServers() const {
@@ -11,30 +11,40 @@ using namespace DigitalStage::Auth;
 
 void printStage(std::weak_ptr<DigitalStage::Api::Store> store)
 {
+    using Level = DigitalStage::Api::StageTree::Level;
     auto s = store.lock();
-    auto stages = s->stages.getAll();
-    for (const auto& stage : stages) {
-        std::cout << "[" << stage.name << "] " << std::endl;
-        auto groups = s->getGroupsByStage(stage._id);
-        for (const auto& group : groups) {
-            std::cout << "  [" << group.name << "]" << std::endl;
-            auto stageMembers = s->getStageMembersByGroup(group._id);
-            for (const auto& stageMember : stageMembers) {
-                auto user = s->users.get(stageMember.userId);
-                std::cout << "    [" << stageMember._id << ": " << (user ? user->name : "") << "]" << std::endl;
-                auto stageDevices = s->getStageDevicesByStageMember(stageMember._id);
-                for (const auto& stageDevice : stageDevices) {
-                    auto videoTracks = s->getVideoTracksByStageDevice(stageDevice._id);
-                    for (const auto& videoTrack : videoTracks) {
-                        std::cout << "      [Video Track " << videoTrack._id << "]" << std::endl;
-                    }
-                    auto audioTracks = s->getAudioTracksByStageDevice(stageDevice._id);
-                    for (const auto& audioTrack : audioTracks) {
-                        std::cout << "      [Audio Track " << audioTrack._id << "]" << std::endl;
-                    }
-                }
+    // Walk the materialized hierarchy instead of querying each level
+    for (const auto& stage : s->stageTree.stages()) {
+        s->stageTree.visit(stage, [&s](const DigitalStage::Api::StageTree::Handle& node, std::size_t depth) {
+            std::cout << std::string(depth * 2, ' ');
+            switch (node.level) {
+            case Level::Stage: {
+                auto item = s->stages.getShared(node.id);
+                std::cout << "[" << (item ? item->name : node.id.str()) << "] " << std::endl;
+                break;
             }
-        }
+            case Level::Group: {
+                auto item = s->groups.getShared(node.id);
+                std::cout << "[" << (item ? item->name : node.id.str()) << "]" << std::endl;
+                break;
+            }
+            case Level::StageMember: {
+                auto item = s->stageMembers.getShared(node.id);
+                auto user = item ? s->users.getShared(item->userId) : nullptr;
+                std::cout << "[" << node.id << ": " << (user ? user->name : "") << "]" << std::endl;
+                break;
+            }
+            case Level::StageDevice:
+                std::cout << "[Stage Device " << node.id << "]" << std::endl;
+                break;
+            case Level::AudioTrack:
+                std::cout << "[Audio Track " << node.id << "]" << std::endl;
+                break;
+            case Level::VideoTrack:
+                std::cout << "[Video Track " << node.id << "]" << std::endl;
+                break;
+            }
+        });
     }
 }
 
@@ -80,7 +90,7 @@ void handleStageJoined(const ID_TYPE& stageId, std::optional<ID_TYPE> groupId, s
     }
 }
 
-void handleStageDeviceChanged(const std::string& id, nlohmann::json, std::weak_ptr<DigitalStage::Api::Store> store)
+void handleStageDeviceChanged(const DigitalStage::Types::ID_TYPE& id, const nlohmann::json&, std::weak_ptr<DigitalStage::Api::Store> store)
 {
     auto s = store.lock();
     auto d = s->stageDevices.get(id);
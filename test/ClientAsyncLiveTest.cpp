@@ -83,19 +83,19 @@ TEST(ClientTest, AsyncLive) {
       EXPECT_ANY_THROW(client->decodeInvitationCode("ABC").get());
 
       std::cout << "Generate invite code with group" << std::endl;
-      auto invite_code_with_group = client->encodeInvitationCode(stage._id, group._id).get();
+      auto invite_code_with_group = client->encodeInvitationCode(stage._id.str(), group._id.str()).get();
 
       std::cout << "Decode invite code with group" << std::endl;
       auto invite_pair = client->decodeInvitationCode(invite_code_with_group).get();
-      EXPECT_EQ(invite_pair.first, stage._id);
-      EXPECT_EQ(invite_pair.second, group._id);
+      EXPECT_EQ(invite_pair.first, stage._id.str());
+      EXPECT_EQ(invite_pair.second, group._id.str());
 
       std::cout << "Generate invite code without group" << std::endl;
-      auto invite_code_without_group = client->encodeInvitationCode(stage._id).get();
+      auto invite_code_without_group = client->encodeInvitationCode(stage._id.str()).get();
 
       std::cout << "Decode invite code without group" << std::endl;
       auto invite_pair_without_group = client->decodeInvitationCode(invite_code_without_group).get();
-      EXPECT_EQ(invite_pair_without_group.first, stage._id);
+      EXPECT_EQ(invite_pair_without_group.first, stage._id.str());
       std::cout << *invite_pair_without_group.second << std::endl;
       if(invite_pair_without_group.second) {
         FAIL() << "GroupId of decoded code (created without group) is not std::nullopt, but: " << *invite_pair_without_group.second;
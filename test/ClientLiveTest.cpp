@@ -117,12 +117,12 @@ TEST(ClientTest, Live)
   EXPECT_EQ(group.name, "Testgruppe");
 
   // Generate invite code
-  auto invite_code = client->encodeInvitationCode(stage._id, group._id).get();
+  auto invite_code = client->encodeInvitationCode(stage._id.str(), group._id.str()).get();
 
   // Use invite code
   auto invite_pair = client->decodeInvitationCode(invite_code).get();
-  EXPECT_EQ(invite_pair.first, stage._id);
-  EXPECT_EQ(invite_pair.second, group._id);
+  EXPECT_EQ(invite_pair.first, stage._id.str());
+  EXPECT_EQ(invite_pair.second, group._id.str());
 
   // Now join stage
   std::cout << "Join stage" << std::endl;
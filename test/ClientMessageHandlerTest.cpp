@@ -14,8 +14,8 @@ TEST(ClientTest, MessageHandler) {
   // We don't connect, instead validating the handleMessage method of the client
   EXPECT_NO_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::LOCAL_DEVICE_READY,
                                      {
-                                         {"_id", "1234"},
-                                         {"userId", "1234"},
+                                         {"_id", "000000000000000000001234"},
+                                         {"userId", "000000000000000000001234"},
                                          {"uuid", "Teststage"},
                                          {"type", "Teststage"},
                                          {"online", true},
@@ -43,4 +43,131 @@ TEST(ClientTest, MessageHandler) {
                DigitalStage::Api::InvalidPayloadException);
   EXPECT_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::LOCAL_DEVICE_READY, {{"none", "1234"}}),
                DigitalStage::Api::InvalidPayloadException);
-}
\ No newline at end of file
+}
+
+TEST(ClientTest, StageJoinedIsAppliedAtOnce) {
+  auto client = std::make_shared<DigitalStage::Api::Client>(API_URL);
+  const nlohmann::json stageMember = {{"_id", "050000000000000000000001"}, {"stageId", "030000000000000000000001"}, {"userId", "010000000000000000000001"}, {"groupId", nullptr}, {"active", true}, {"isDirector", false}};
+  const nlohmann::json audioTrack = {{"_id", "070000000000000000000001"}, {"userId", "010000000000000000000001"}, {"deviceId", "020000000000000000000001"}, {"stageId", "030000000000000000000001"},
+                                     {"stageMemberId", "050000000000000000000001"}, {"stageDeviceId", "060000000000000000000001"}, {"type", "native"}};
+
+  // Observers of single entities already see the whole stage
+  std::size_t tracksSeenByMemberSlot = 0;
+  client->stageMemberAdded.connect([&tracksSeenByMemberSlot](const DigitalStage::Types::StageMember& member, std::weak_ptr<DigitalStage::Api::Store> store) {
+    tracksSeenByMemberSlot = store.lock()->getAudioTracksByStageMember(member._id).size();
+  });
+  std::size_t changeNotifications = 0;
+  client->getStore().lock()->changed.connect([&changeNotifications](const DigitalStage::Api::Store::ChangeSet&) { changeNotifications++; });
+
+  EXPECT_NO_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::STAGE_JOINED,
+                                        {{"stageId", "030000000000000000000001"},
+                                         {"stageMemberId", "050000000000000000000001"},
+                                         {"groupId", nullptr},
+                                         {"stageMembers", {stageMember}},
+                                         {"stageDevices", nlohmann::json::array()},
+                                         {"audioTracks", {audioTrack}},
+                                         {"videoTracks", nlohmann::json::array()}}));
+  EXPECT_EQ(tracksSeenByMemberSlot, 1);
+  EXPECT_EQ(changeNotifications, 1);
+  EXPECT_EQ(client->getStore().lock()->snapshot()->stageId, DigitalStage::Types::ID_TYPE("030000000000000000000001"));
+
+  // An invalid payload is rejected before a new stage session and its arena are started
+  const auto arena = client->getStore().lock()->stageMembers.getArena();
+  EXPECT_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::STAGE_JOINED,
+                                     {{"stageId", "030000000000000000000002"},
+                                      {"stageMemberId", "050000000000000000000002"},
+                                      {"groupId", nullptr},
+                                      {"stageMembers", {{{"_id", 1}}}}}),
+               DigitalStage::Api::InvalidPayloadException);
+  EXPECT_EQ(client->getStore().lock()->stageMembers.getArena(), arena);
+  EXPECT_EQ(client->getStore().lock()->getStageId(), DigitalStage::Types::ID_TYPE("030000000000000000000001"));
+  EXPECT_EQ(changeNotifications, 1);
+}
+
+TEST(ClientTest, RegisterHandler) {
+  auto client = std::make_shared<DigitalStage::Api::Client>(API_URL);
+
+  // Unknown events are ignored until a handler is registered for them
+  EXPECT_NO_THROW(client->handleMessage("custom-event", {{"value", 1}}));
+
+  int value = 0;
+  client->registerHandler("custom-event", [&value](const std::string& event, const nlohmann::json& payload) {
+    EXPECT_EQ(event, "custom-event");
+    value = payload["value"];
+  });
+  client->handleMessage("custom-event", {{"value", 2}});
+  EXPECT_EQ(value, 2);
+
+  EXPECT_THROW(client->registerHandler("custom-event", [](const std::string&, const nlohmann::json&) {}), std::invalid_argument);
+  EXPECT_THROW(client->registerHandler(DigitalStage::Api::RetrieveEvents::AUDIO_TRACK_ADDED, [](const std::string&, const nlohmann::json&) {}),
+               std::invalid_argument);
+}
+
+TEST(ClientTest, StageJoinedFindsLocalStageDevice) {
+  const nlohmann::json stageMember = {{"_id", "050000000000000000000001"}, {"stageId", "030000000000000000000001"}, {"userId", "010000000000000000000001"}, {"groupId", nullptr}, {"active", true}, {"isDirector", false}};
+  const nlohmann::json stageDevice = {{"_id", "060000000000000000000001"}, {"userId", "010000000000000000000001"}, {"deviceId", "020000000000000000000001"}, {"stageId", "030000000000000000000001"},
+                                      {"stageMemberId", "050000000000000000000001"}, {"active", true}, {"type", "native"}, {"order", 0}, {"sendLocal", true}};
+  const nlohmann::json audioTrack = {{"_id", "070000000000000000000001"}, {"userId", "010000000000000000000001"}, {"deviceId", "020000000000000000000001"}, {"stageId", "030000000000000000000001"},
+                                     {"stageMemberId", "050000000000000000000001"}, {"stageDeviceId", "060000000000000000000001"}, {"type", "native"}};
+  const nlohmann::json localDevice = {{"_id", "020000000000000000000001"}, {"userId", "010000000000000000000001"}, {"uuid", "local"}, {"type", "native"}, {"online", true},
+                                      {"canVideo", false}, {"canAudio", true}, {"sendVideo", false}, {"sendAudio", true}, {"receiveVideo", false}, {"receiveAudio", true},
+                                      {"buffer", 5}, {"volume", 1.0}, {"balance", 0.5}};
+  // Lists which are not sent are treated as empty
+  const nlohmann::json payload = {{"stageDevices", {stageDevice}}, {"stageMembers", {stageMember}}, {"audioTracks", {audioTrack}}, {"videoTracks", nlohmann::json::array()},
+                                  {"stageId", "030000000000000000000001"}, {"stageMemberId", "050000000000000000000001"}, {"groupId", nullptr}};
+
+  auto client = std::make_shared<DigitalStage::Api::Client>(API_URL);
+  EXPECT_NO_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::LOCAL_DEVICE_READY, localDevice));
+  std::size_t stageDevicesAdded = 0;
+  client->stageDeviceAdded.connect([&stageDevicesAdded](const DigitalStage::Types::StageDevice&, std::weak_ptr<DigitalStage::Api::Store>) { stageDevicesAdded++; });
+  std::optional<DigitalStage::Types::ID_TYPE> joinedStageId;
+  client->stageJoined.connect([&joinedStageId](const DigitalStage::Types::ID_TYPE& stageId, const std::optional<DigitalStage::Types::ID_TYPE>&, std::weak_ptr<DigitalStage::Api::Store>) {
+    joinedStageId = stageId;
+  });
+  EXPECT_NO_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::STAGE_JOINED, payload));
+  EXPECT_EQ(stageDevicesAdded, 1);
+  EXPECT_EQ(joinedStageId, DigitalStage::Types::ID_TYPE("030000000000000000000001"));
+  const auto store = client->getStore().lock();
+  EXPECT_EQ(store->getStageDeviceId(), DigitalStage::Types::ID_TYPE("060000000000000000000001"));
+  EXPECT_EQ(store->getAudioTracksByStageMember(DigitalStage::Types::ID_TYPE("050000000000000000000001")).size(), 1);
+
+  // Leaving removes every stage scoped entity, so the arena of the session is released
+  const std::weak_ptr<DigitalStage::Api::StageArena> arena = store->stageDevices.getArena();
+  ASSERT_FALSE(arena.expired());
+  EXPECT_NO_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::STAGE_LEFT, nlohmann::json::object()));
+  EXPECT_TRUE(store->stageDevices.getAll().empty());
+  EXPECT_TRUE(arena.expired());
+}
+
+TEST(ClientTest, SignalsPassReferences) {
+  auto client = std::make_shared<DigitalStage::Api::Client>(API_URL);
+  const nlohmann::json payload = {{"_id", "070000000000000000000001"}, {"volume", 0.5}};
+
+  // Every slot gets the very same patch and store instead of a copy
+  std::vector<const nlohmann::json*> patches;
+  std::vector<const std::weak_ptr<DigitalStage::Api::Store>*> stores;
+  for (int i = 0; i < 2; ++i) {
+    client->audioTrackChanged.connect([&](const DigitalStage::Types::ID_TYPE&, const nlohmann::json& patch, const std::weak_ptr<DigitalStage::Api::Store>& store) {
+      patches.push_back(&patch);
+      stores.push_back(&store);
+    });
+  }
+  client->handleMessage(DigitalStage::Api::RetrieveEvents::AUDIO_TRACK_CHANGED, payload);
+  ASSERT_EQ(patches.size(), 2);
+  EXPECT_EQ(patches[0], &payload);
+  EXPECT_EQ(patches[1], &payload);
+  EXPECT_EQ(stores[0], stores[1]);
+}
+
+TEST(ClientTest, SignalOnlyValuesAreParsedLazily) {
+  auto client = std::make_shared<DigitalStage::Api::Client>(API_URL);
+  const nlohmann::json invalidOffer = {{"from", 1234}};
+
+  // Nothing needs the offer, so it is not parsed at all
+  EXPECT_NO_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::P2P_OFFER_SENT, invalidOffer));
+
+  bool received = false;
+  client->p2pOffer.connect([&received](const DigitalStage::Types::P2POffer&, const std::weak_ptr<DigitalStage::Api::Store>&) { received = true; });
+  EXPECT_THROW(client->handleMessage(DigitalStage::Api::RetrieveEvents::P2P_OFFER_SENT, invalidOffer), DigitalStage::Api::InvalidPayloadException);
+  EXPECT_FALSE(received);
+}
@@ -0,0 +1,228 @@
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <DigitalStage/Api/EventDispatcher.h>
+
+using DigitalStage::Api::EventDispatcher;
+
+namespace {
+  /**
+   * Handler, which blocks the dispatcher thread until it is released
+   */
+  class Gate {
+  public:
+    void wait()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      entered_ = true;
+      entered_cv_.notify_all();
+      open_cv_.wait(lock, [this] { return open_; });
+    }
+
+    void waitUntilEntered()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      entered_cv_.wait(lock, [this] { return entered_; });
+    }
+
+    void open()
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      open_ = true;
+      open_cv_.notify_all();
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable entered_cv_;
+    std::condition_variable open_cv_;
+    bool entered_ = false;
+    bool open_ = false;
+  };
+
+  template <typename Predicate>
+  bool waitFor(Predicate predicate)
+  {
+    for (int i = 0; i < 1000 && !predicate(); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return predicate();
+  }
+} // namespace
+
+TEST(EventDispatcherTest, BoundedQueue) {
+  DigitalStage::Api::BoundedQueue<int> queue(3);
+  EXPECT_EQ(queue.capacity(), 4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(queue.tryPush(int(i)));
+  }
+  EXPECT_FALSE(queue.tryPush(4));
+  EXPECT_EQ(queue.size(), 4);
+
+  int value = -1;
+  EXPECT_TRUE(queue.tryPop(value));
+  EXPECT_EQ(value, 0);
+  EXPECT_TRUE(queue.tryPush(4));
+  for (int i = 1; i <= 4; ++i) {
+    EXPECT_TRUE(queue.tryPop(value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(queue.tryPop(value));
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(EventDispatcherTest, DispatchesInOrderOnOwnThread) {
+  std::mutex mutex;
+  std::vector<int> received;
+  std::thread::id dispatcherThread;
+  EventDispatcher dispatcher(
+      [&](const std::string& event, const nlohmann::json& payload) {
+        std::lock_guard<std::mutex> lock(mutex);
+        EXPECT_EQ(event, "e");
+        received.push_back(payload["n"]);
+        dispatcherThread = std::this_thread::get_id();
+      },
+      {});
+
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(dispatcher.post("e", {{"n", i}}));
+  }
+  ASSERT_TRUE(waitFor([&] { return dispatcher.metrics().dispatched == 100; }));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_EQ(received.size(), 100);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(received[i], i);
+  }
+  EXPECT_NE(dispatcherThread, std::this_thread::get_id());
+  const auto metrics = dispatcher.metrics();
+  EXPECT_EQ(metrics.depth, 0);
+  EXPECT_GE(metrics.peakDepth, 1);
+  EXPECT_EQ(metrics.dropped, 0);
+  EXPECT_GE(metrics.maxWait, metrics.lastWait);
+  EXPECT_GE(metrics.totalWait, metrics.maxWait);
+}
+
+TEST(EventDispatcherTest, OverflowPolicies) {
+  for (const auto policy : {EventDispatcher::OverflowPolicy::DropNewest, EventDispatcher::OverflowPolicy::DropOldest}) {
+    Gate gate;
+    std::mutex mutex;
+    std::vector<int> received;
+    EventDispatcher::Options options;
+    options.capacity = 2;
+    options.overflow = policy;
+    EventDispatcher dispatcher(
+        [&](const std::string&, const nlohmann::json& payload) {
+          if (payload["n"] == 0) {
+            gate.wait();
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          received.push_back(payload["n"]);
+        },
+        options);
+
+    // The first event blocks the dispatcher thread, the queue takes two more
+    EXPECT_TRUE(dispatcher.post("e", {{"n", 0}}));
+    gate.waitUntilEntered();
+    EXPECT_TRUE(dispatcher.post("e", {{"n", 1}}));
+    EXPECT_TRUE(dispatcher.post("e", {{"n", 2}}));
+    EXPECT_EQ(dispatcher.post("e", {{"n", 3}}), policy == EventDispatcher::OverflowPolicy::DropOldest);
+    EXPECT_EQ(dispatcher.metrics().depth, 2);
+    EXPECT_EQ(dispatcher.metrics().dropped, 1);
+
+    gate.open();
+    ASSERT_TRUE(waitFor([&] { return dispatcher.metrics().dispatched == 3; }));
+    std::lock_guard<std::mutex> lock(mutex);
+    if (policy == EventDispatcher::OverflowPolicy::DropNewest) {
+      EXPECT_EQ(received, std::vector<int>({0, 1, 2}));
+    }
+    else {
+      EXPECT_EQ(received, std::vector<int>({0, 2, 3}));
+    }
+  }
+}
+
+TEST(EventDispatcherTest, BlockWaitsForRoom) {
+  Gate gate;
+  std::atomic<int> received{0};
+  EventDispatcher::Options options;
+  options.capacity = 2;
+  options.overflow = EventDispatcher::OverflowPolicy::Block;
+  EventDispatcher dispatcher(
+      [&](const std::string&, const nlohmann::json& payload) {
+        if (payload["n"] == 0) {
+          gate.wait();
+        }
+        received++;
+      },
+      options);
+
+  EXPECT_TRUE(dispatcher.post("e", {{"n", 0}}));
+  gate.waitUntilEntered();
+  EXPECT_TRUE(dispatcher.post("e", {{"n", 1}}));
+  EXPECT_TRUE(dispatcher.post("e", {{"n", 2}}));
+  std::thread producer([&] { EXPECT_TRUE(dispatcher.post("e", {{"n", 3}})); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  EXPECT_EQ(received, 0);
+  gate.open();
+  producer.join();
+  ASSERT_TRUE(waitFor([&] { return received == 4; }));
+  EXPECT_EQ(dispatcher.metrics().dropped, 0);
+}
+
+TEST(EventDispatcherTest, CoalescesPatchesOfSameEntity) {
+  Gate gate;
+  std::mutex mutex;
+  std::vector<std::pair<std::string, nlohmann::json>> received;
+  EventDispatcher::Options options;
+  options.coalesce = {"changed"};
+  EventDispatcher dispatcher(
+      [&](const std::string& event, const nlohmann::json& payload) {
+        if (event == "block") {
+          gate.wait();
+          return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        received.emplace_back(event, payload);
+      },
+      options);
+
+  // Queue everything while the dispatcher thread is busy, so it is merged once the thread continues
+  dispatcher.post("block", nullptr);
+  gate.waitUntilEntered();
+  dispatcher.post("changed", {{"_id", "a"}, {"volume", 0.1}});
+  dispatcher.post("changed", {{"_id", "b"}, {"volume", 0.5}});
+  dispatcher.post("changed", {{"_id", "a"}, {"volume", 0.2}, {"muted", true}});
+  dispatcher.post("changed", {{"_id", "a"}, {"volume", 0.3}});
+  dispatcher.post("removed", {{"id", "a"}});
+  dispatcher.post("changed", {{"_id", "a"}, {"volume", 0.4}});
+  gate.open();
+  ASSERT_TRUE(waitFor([&] { return dispatcher.metrics().dispatched == 5; }));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_EQ(received.size(), 4);
+  EXPECT_EQ(received[0].second, nlohmann::json({{"_id", "a"}, {"volume", 0.3}, {"muted", true}}));
+  EXPECT_EQ(received[1].second, nlohmann::json({{"_id", "b"}, {"volume", 0.5}}));
+  EXPECT_EQ(received[2].first, "removed");
+  EXPECT_EQ(received[3].second, nlohmann::json({{"_id", "a"}, {"volume", 0.4}}));
+  EXPECT_EQ(dispatcher.metrics().coalesced, 2);
+}
+
+TEST(EventDispatcherTest, CoalesceWindow) {
+  std::atomic<int> received{0};
+  EventDispatcher::Options options;
+  options.coalesce = {"changed"};
+  options.coalesceWindow = std::chrono::milliseconds(50);
+  EventDispatcher dispatcher([&](const std::string&, const nlohmann::json&) { received++; }, options);
+
+  // Patches are held back for the window, even though the queue drained in between
+  dispatcher.post("changed", {{"_id", "a"}, {"volume", 0.1}});
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  dispatcher.post("changed", {{"_id", "a"}, {"volume", 0.2}});
+  ASSERT_TRUE(waitFor([&] { return received == 1; }));
+  EXPECT_EQ(dispatcher.metrics().coalesced, 1);
+}
@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+
+#include <DigitalStage/Api/FlatMap.h>
+
+TEST(FlatMapTest, StringViewLookups) {
+  DigitalStage::Api::FlatMap<int> map;
+  EXPECT_TRUE(map.try_emplace("first", 1).second);
+  EXPECT_FALSE(map.try_emplace("first", 2).second);
+  map["second"] = 2;
+
+  const std::string_view key = "second";
+  EXPECT_EQ(map.count(key), 1);
+  EXPECT_EQ(map.at(key), 2);
+  EXPECT_EQ(map.find("first")->second, 1);
+  EXPECT_EQ(map.find("third"), map.end());
+  EXPECT_THROW(map.at("third"), std::out_of_range);
+
+  EXPECT_EQ(map.erase("first"), 1);
+  EXPECT_EQ(map.erase("first"), 0);
+  EXPECT_EQ(map.size(), 1);
+  EXPECT_EQ(map.at("second"), 2);
+}
+
+TEST(FlatMapTest, MatchesStdMap) {
+  // Use a bad hash to force long probe sequences and backward shifting on erase
+  struct CollidingHash {
+    std::size_t operator()(std::string_view key) const noexcept { return key.empty() ? 0 : key[0] % 3; }
+  };
+  DigitalStage::Api::FlatMap<int, CollidingHash> map;
+  std::map<std::string, int> expected;
+  std::mt19937 random(1234);
+  for (int i = 0; i < 20000; i++) {
+    const auto key = std::to_string(random() % 500);
+    if (random() % 3 != 0) {
+      map[key] = i;
+      expected[key] = i;
+    } else {
+      EXPECT_EQ(map.erase(key), expected.erase(key));
+    }
+  }
+  ASSERT_EQ(map.size(), expected.size());
+  for (const auto& item : expected) {
+    EXPECT_EQ(map.at(item.first), item.second);
+  }
+  for (const auto& item : map) {
+    EXPECT_EQ(expected.at(item.first), item.second);
+  }
+}
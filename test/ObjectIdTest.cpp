@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <sstream>
+#include <unordered_set>
+
+#include <DigitalStage/Types.h>
+
+using DigitalStage::Types::ObjectId;
+
+TEST(ObjectIdTest, HexRoundTrip) {
+  const ObjectId id("61a4f0c2e13b5d0012f3a9bc");
+  EXPECT_EQ(id.str(), "61a4f0c2e13b5d0012f3a9bc");
+  EXPECT_EQ(id.bytes().size(), ObjectId::kSize);
+  EXPECT_EQ(static_cast<unsigned char>(id.bytes()[0]), 0x61);
+  EXPECT_EQ(static_cast<unsigned char>(id.bytes()[11]), 0xbc);
+
+  // Upper case input is accepted, output is always lower case
+  EXPECT_EQ(ObjectId("61A4F0C2E13B5D0012F3A9BC"), id);
+
+  std::ostringstream stream;
+  stream << id;
+  EXPECT_EQ(stream.str(), "61a4f0c2e13b5d0012f3a9bc");
+
+  EXPECT_EQ(ObjectId().str(), "000000000000000000000000");
+}
+
+TEST(ObjectIdTest, InvalidInput) {
+  EXPECT_FALSE(ObjectId::fromHex(""));
+  EXPECT_FALSE(ObjectId::fromHex("61a4f0c2e13b5d0012f3a9b"));
+  EXPECT_FALSE(ObjectId::fromHex("61a4f0c2e13b5d0012f3a9bcd"));
+  EXPECT_FALSE(ObjectId::fromHex("61a4f0c2e13b5d0012f3a9bg"));
+  EXPECT_TRUE(ObjectId::fromHex("61a4f0c2e13b5d0012f3a9bc"));
+  EXPECT_THROW(ObjectId("track1"), DigitalStage::Types::ParseException);
+}
+
+TEST(ObjectIdTest, Json) {
+  const ObjectId id("61a4f0c2e13b5d0012f3a9bc");
+  const nlohmann::json j = id;
+  EXPECT_EQ(j, "61a4f0c2e13b5d0012f3a9bc");
+  EXPECT_EQ(j.get<ObjectId>(), id);
+  EXPECT_THROW(nlohmann::json("invalid").get<ObjectId>(), DigitalStage::Types::ParseException);
+}
+
+TEST(ObjectIdTest, CompareAndHash) {
+  const ObjectId a("61a4f0c2e13b5d0012f3a9bc");
+  const ObjectId b("61a4f0c2e13b5d0012f3a9bd");
+  EXPECT_NE(a, b);
+  EXPECT_LT(a, b);
+  EXPECT_FALSE(b < a);
+  EXPECT_EQ(a, ObjectId(a.str()));
+  EXPECT_EQ(std::hash<ObjectId>()(a), std::hash<ObjectId>()(ObjectId(a.str())));
+
+  std::unordered_set<ObjectId> ids;
+  for (int i = 0; i < 1000; ++i) {
+    char hex[25];
+    std::snprintf(hex, sizeof(hex), "61a4f0c2e13b5d%010x", i);
+    ids.insert(ObjectId(hex));
+  }
+  EXPECT_EQ(ids.size(), 1000);
+  EXPECT_EQ(ids.count(ObjectId("61a4f0c2e13b5d00000003e7")), 1);
+}
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+#include <DigitalStage/Api/PersistentMap.h>
+
+TEST(PersistentMapTest, VersionsAreIndependent) {
+  DigitalStage::Api::PersistentMap<std::string, int> first;
+  first.set("a", 1);
+  first.set("b", 2);
+
+  auto second = first;
+  second.set("a", 10);
+  second.set("c", 3);
+  EXPECT_EQ(second.erase("b"), 1);
+  EXPECT_EQ(second.erase("b"), 0);
+
+  EXPECT_EQ(first.size(), 2);
+  EXPECT_EQ(first.at("a"), 1);
+  EXPECT_EQ(first.at("b"), 2);
+  EXPECT_EQ(first.count("c"), 0);
+  EXPECT_EQ(second.size(), 2);
+  EXPECT_EQ(second.at("a"), 10);
+  EXPECT_EQ(second.find("b"), second.end());
+  EXPECT_EQ(second.find("c")->second, 3);
+  EXPECT_THROW(second.at("b"), std::out_of_range);
+
+  second.clear();
+  EXPECT_TRUE(second.empty());
+  EXPECT_EQ(second.begin(), second.end());
+  EXPECT_EQ(first.size(), 2);
+}
+
+TEST(PersistentMapTest, MatchesStdMap) {
+  // Use a bad hash to force full hash collisions, which end up in the deepest leaves
+  struct CollidingHash {
+    std::size_t operator()(int key) const noexcept { return key % 3; }
+  };
+  using Map = DigitalStage::Api::PersistentMap<int, int, CollidingHash>;
+  // Few keys make the colliding map go deep, many keys make the other one grow wide
+  for (const int keys : {50, 2000}) {
+    Map collidingMap;
+    DigitalStage::Api::PersistentMap<int, int> map;
+    std::map<int, int> expected;
+    std::vector<std::pair<Map, std::map<int, int>>> versions;
+    std::mt19937 random(1234);
+    for (int i = 0; i < 20000; i++) {
+      const int key = static_cast<int>(random() % keys);
+      if (random() % 3 != 0) {
+        collidingMap.set(key, i);
+        map.set(key, i);
+        expected[key] = i;
+      } else {
+        const auto erased = expected.erase(key);
+        EXPECT_EQ(collidingMap.erase(key), erased);
+        EXPECT_EQ(map.erase(key), erased);
+      }
+      if (i % 1000 == 0) {
+        versions.emplace_back(collidingMap, expected);
+      }
+    }
+    ASSERT_EQ(map.size(), expected.size());
+    ASSERT_EQ(collidingMap.size(), expected.size());
+    for (const auto& item : expected) {
+      EXPECT_EQ(map.at(item.first), item.second);
+      EXPECT_EQ(collidingMap.at(item.first), item.second);
+    }
+    std::map<int, int> visited;
+    for (const auto& item : map) {
+      EXPECT_TRUE(visited.emplace(item.first, item.second).second);
+    }
+    EXPECT_EQ(visited, expected);
+    visited.clear();
+    for (const auto& item : collidingMap) {
+      EXPECT_TRUE(visited.emplace(item.first, item.second).second);
+    }
+    EXPECT_EQ(visited, expected);
+
+    // Earlier versions still hold what they held when they were copied
+    for (const auto& version : versions) {
+      ASSERT_EQ(version.first.size(), version.second.size());
+      for (const auto& item : version.second) {
+        EXPECT_EQ(version.first.at(item.first), item.second);
+      }
+    }
+  }
+}
@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <DigitalStage/Api/SendBatcher.h>
+
+using DigitalStage::Api::SendBatcher;
+
+namespace {
+  /**
+   * Records the sent messages and answers each of them with its position
+   */
+  class Recorder {
+  public:
+    SendBatcher::Sender sender()
+    {
+      return [this](const std::string& event, const nlohmann::json& payload, const SendBatcher::Callback& callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto position = sent_.size();
+        sent_.emplace_back(event, payload);
+        if (callback) {
+          callback({position});
+        }
+      };
+    }
+
+    std::vector<std::pair<std::string, nlohmann::json>> sent()
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return sent_;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::vector<std::pair<std::string, nlohmann::json>> sent_;
+  };
+} // namespace
+
+TEST(SendBatcherTest, SendsRightAwayWithoutBatch) {
+  Recorder recorder;
+  SendBatcher batcher(recorder.sender(), {"change"});
+  batcher.send("change", {{"_id", "a"}, {"volume", 0.1}}, nullptr);
+  batcher.send("change", {{"_id", "a"}, {"volume", 0.2}}, nullptr);
+  EXPECT_EQ(recorder.sent().size(), 2);
+  EXPECT_EQ(batcher.merged(), 0);
+}
+
+TEST(SendBatcherTest, MergesChangesWithinBatch) {
+  Recorder recorder;
+  SendBatcher batcher(recorder.sender(), {"change"});
+  std::vector<int> results(5, -1);
+  const auto resolve = [&results](int index) {
+    return [&results, index](const std::vector<nlohmann::json>& result) { results[index] = result[0]; };
+  };
+
+  batcher.begin();
+  batcher.send("change", {{"_id", "a"}, {"volume", 0.1}}, resolve(0));
+  batcher.send("change", {{"_id", "b"}, {"volume", 0.5}}, resolve(1));
+  batcher.begin();
+  batcher.send("change", {{"_id", "a"}, {"volume", 0.2}, {"muted", true}}, resolve(2));
+  batcher.commit();
+  batcher.send("remove", {{"_id", "a"}}, resolve(3));
+  batcher.send("change", {{"_id", "a"}, {"volume", 0.3}}, resolve(4));
+  EXPECT_TRUE(recorder.sent().empty());
+  batcher.commit();
+
+  const auto sent = recorder.sent();
+  ASSERT_EQ(sent.size(), 4);
+  EXPECT_EQ(sent[0].second, nlohmann::json({{"_id", "a"}, {"volume", 0.2}, {"muted", true}}));
+  EXPECT_EQ(sent[1].second, nlohmann::json({{"_id", "b"}, {"volume", 0.5}}));
+  EXPECT_EQ(sent[2].first, "remove");
+  EXPECT_EQ(sent[3].second, nlohmann::json({{"_id", "a"}, {"volume", 0.3}}));
+  // Each callback is resolved, merged ones with the result of the message sent in their place
+  EXPECT_EQ(results, std::vector<int>({0, 1, 0, 2, 3}));
+  EXPECT_EQ(batcher.merged(), 1);
+}
+
+TEST(SendBatcherTest, SendsAfterWindow) {
+  Recorder recorder;
+  SendBatcher batcher(recorder.sender(), {"change"});
+  batcher.setWindow(std::chrono::milliseconds(20));
+  for (int i = 0; i < 32; ++i) {
+    batcher.send("change", {{"_id", "a"}, {"channel", i}}, nullptr);
+  }
+  EXPECT_TRUE(recorder.sent().empty());
+  for (int i = 0; i < 1000 && recorder.sent().empty(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  const auto sent = recorder.sent();
+  ASSERT_EQ(sent.size(), 1);
+  EXPECT_EQ(sent[0].second["channel"], 31);
+  EXPECT_EQ(batcher.merged(), 31);
+}
+
+TEST(SendBatcherTest, PriorityOvertakesBulk) {
+  Recorder recorder;
+  SendBatcher batcher(recorder.sender(), {"change"}, {"offer"});
+
+  batcher.begin();
+  batcher.send("change", {{"_id", "a"}, {"volume", 0.1}}, nullptr);
+  batcher.send("change", {{"_id", "b"}, {"volume", 0.1}}, nullptr);
+  EXPECT_EQ(batcher.metrics().bulk.depth, 2);
+  // Not batched, although a batch is open
+  batcher.send("offer", {{"to", "peer"}}, nullptr);
+  EXPECT_EQ(recorder.sent().size(), 1);
+  batcher.commit();
+
+  const auto sent = recorder.sent();
+  ASSERT_EQ(sent.size(), 3);
+  EXPECT_EQ(sent[0].first, "offer");
+  const auto metrics = batcher.metrics();
+  EXPECT_EQ(metrics.priority.sent, 1);
+  EXPECT_EQ(metrics.bulk.sent, 2);
+  EXPECT_EQ(metrics.bulk.depth, 0);
+  EXPECT_EQ(metrics.bulk.peakDepth, 2);
+  EXPECT_GE(metrics.bulk.totalLatency, metrics.bulk.maxLatency);
+}
+
+TEST(SendBatcherTest, PriorityOvertakesMessagesBeingSent) {
+  std::mutex mutex;
+  std::vector<std::string> sent;
+  std::unique_ptr<SendBatcher> batcher;
+  std::thread signaling;
+  batcher = std::make_unique<SendBatcher>(
+      [&](const std::string& event, const nlohmann::json&, const SendBatcher::Callback&) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          sent.push_back(event);
+        }
+        if (event == "change" && !signaling.joinable()) {
+          // Another thread sends an offer, while the first of the bulk messages is being sent
+          signaling = std::thread([&batcher] { batcher->send("offer", nullptr, nullptr); });
+          while (batcher->metrics().priority.peakDepth == 0) {
+            std::this_thread::yield();
+          }
+        }
+      },
+      std::set<std::string>{"change"}, std::set<std::string>{"offer"});
+
+  batcher->begin();
+  for (int i = 0; i < 3; ++i) {
+    batcher->send("change", {{"_id", std::to_string(i)}}, nullptr);
+  }
+  batcher->commit();
+  signaling.join();
+  EXPECT_EQ(sent, std::vector<std::string>({"change", "offer", "change", "change"}));
+}
+
+TEST(SendBatcherTest, ResolvesCallbacksWhenSendingFails) {
+  std::size_t attempts = 0;
+  SendBatcher batcher(
+      [&attempts](const std::string&, const nlohmann::json&, const SendBatcher::Callback&) {
+        attempts++;
+        throw std::runtime_error("not connected");
+      },
+      {"change"});
+  std::vector<std::vector<nlohmann::json>> results(3);
+  const auto resolve = [&results](int index) {
+    return [&results, index](const std::vector<nlohmann::json>& result) { results[index] = result; };
+  };
+
+  batcher.begin();
+  batcher.send("change", {{"_id", "a"}, {"volume", 0.1}}, resolve(0));
+  batcher.send("change", {{"_id", "a"}, {"volume", 0.2}}, resolve(1));
+  batcher.send("remove", {{"_id", "b"}}, resolve(2));
+  EXPECT_NO_THROW(batcher.commit());
+
+  // Every callback gets the error, including the one of the merged message
+  EXPECT_EQ(attempts, 2);
+  for (const auto& result : results) {
+    ASSERT_EQ(result.size(), 1);
+    EXPECT_EQ(result[0], "Could not send message: not connected");
+  }
+}
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include <DigitalStage/Api/Store.h>
+
+using Handle = DigitalStage::Api::StageTree::Handle;
+using Level = DigitalStage::Api::StageTree::Level;
+using DigitalStage::Types::ID_TYPE;
+
+namespace {
+  void createStage(DigitalStage::Api::Store& store)
+  {
+    auto transaction = store.transaction();
+    transaction.stages.create({{"_id", "030000000000000000000001"}, {"name", "Stage"}, {"description", ""}, {"admins", nlohmann::json::array()},
+                               {"soundEditors", nlohmann::json::array()}, {"videoType", "mediasoup"}, {"audioType", "mediasoup"},
+                               {"width", 25}, {"length", 13}, {"height", 7.5}, {"absorption", 0.6}, {"reflection", 0.7}});
+    for (const auto& groupId : {"040000000000000000000001", "040000000000000000000002"}) {
+      transaction.groups.create({{"_id", groupId}, {"stageId", "030000000000000000000001"}, {"name", groupId}, {"description", ""}, {"color", "#fff"}});
+    }
+    transaction.stageMembers.create({{"_id", "050000000000000000000001"}, {"stageId", "030000000000000000000001"}, {"userId", "010000000000000000000001"}, {"active", true},
+                                     {"isDirector", false}, {"groupId", "040000000000000000000001"}});
+    transaction.stageDevices.create({{"_id", "060000000000000000000001"}, {"userId", "010000000000000000000001"}, {"deviceId", "020000000000000000000001"}, {"stageId", "030000000000000000000001"},
+                                     {"stageMemberId", "050000000000000000000001"}, {"active", true}, {"type", "native"}, {"order", 0},
+                                     {"sendLocal", false}});
+    transaction.audioTracks.create({{"_id", "070000000000000000000001"}, {"userId", "010000000000000000000001"}, {"deviceId", "020000000000000000000001"}, {"stageId", "030000000000000000000001"},
+                                    {"stageMemberId", "050000000000000000000001"}, {"stageDeviceId", "060000000000000000000001"}, {"type", "native"}});
+    transaction.commit();
+  }
+}
+
+TEST(StageTreeTest, Hierarchy) {
+  DigitalStage::Api::Store store;
+  createStage(store);
+  const auto& tree = store.stageTree;
+
+  EXPECT_EQ(tree.stages(), (std::vector<Handle>{{Level::Stage, ID_TYPE("030000000000000000000001")}}));
+  EXPECT_EQ(tree.children({Level::Stage, ID_TYPE("030000000000000000000001")}), (std::vector<Handle>{{Level::Group, ID_TYPE("040000000000000000000001")}, {Level::Group, ID_TYPE("040000000000000000000002")}}));
+  EXPECT_EQ(tree.parent({Level::AudioTrack, ID_TYPE("070000000000000000000001")}), (Handle{Level::StageDevice, ID_TYPE("060000000000000000000001")}));
+
+  std::vector<std::pair<Handle, std::size_t>> visited;
+  tree.visit({Level::Stage, ID_TYPE("030000000000000000000001")}, [&](const Handle& handle, std::size_t depth) { visited.emplace_back(handle, depth); });
+  ASSERT_EQ(visited.size(), 6);
+  EXPECT_EQ(visited[2], std::make_pair(Handle{Level::StageMember, ID_TYPE("050000000000000000000001")}, std::size_t(2)));
+  EXPECT_EQ(visited[4], std::make_pair(Handle{Level::AudioTrack, ID_TYPE("070000000000000000000001")}, std::size_t(4)));
+  EXPECT_EQ(visited[5], std::make_pair(Handle{Level::Group, ID_TYPE("040000000000000000000002")}, std::size_t(1)));
+}
+
+TEST(StageTreeTest, DirtySubtrees) {
+  DigitalStage::Api::Store store;
+  std::vector<std::set<Handle>> notifications;
+  store.stageTree.dirty.connect([&](const std::set<Handle>& roots) { notifications.push_back(roots); });
+
+  createStage(store);
+  ASSERT_EQ(notifications.size(), 1);
+  EXPECT_EQ(notifications.back(), (std::set<Handle>{{Level::Stage, ID_TYPE("030000000000000000000001")}}));
+
+  // Moving a member marks both groups, but not the stage
+  store.stageMembers.update({{"_id", "050000000000000000000001"}, {"groupId", "040000000000000000000002"}});
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"volume", 0.5}});
+  store.publish();
+  ASSERT_EQ(notifications.size(), 2);
+  EXPECT_EQ(notifications.back(), (std::set<Handle>{{Level::Group, ID_TYPE("040000000000000000000001")}, {Level::Group, ID_TYPE("040000000000000000000002")}}));
+  EXPECT_EQ(store.stageTree.parent({Level::AudioTrack, ID_TYPE("070000000000000000000001")}), (Handle{Level::StageDevice, ID_TYPE("060000000000000000000001")}));
+  EXPECT_TRUE(store.stageTree.children({Level::Group, ID_TYPE("040000000000000000000001")}).empty());
+
+  // Removals are reported by the parent
+  store.audioTracks.remove(ID_TYPE("070000000000000000000001"));
+  store.publish();
+  EXPECT_EQ(notifications.back(), (std::set<Handle>{{Level::StageDevice, ID_TYPE("060000000000000000000001")}}));
+  EXPECT_FALSE(store.stageTree.contains({Level::AudioTrack, ID_TYPE("070000000000000000000001")}));
+
+  // Removing everything leaves no placeholders behind
+  store.stages.removeAll();
+  store.groups.removeAll();
+  store.stageMembers.removeAll();
+  store.stageDevices.removeAll();
+  store.publish();
+  EXPECT_EQ(notifications.back(), (std::set<Handle>{{Level::Stage, ID_TYPE("030000000000000000000001")}}));
+  EXPECT_TRUE(store.stageTree.stages().empty());
+  EXPECT_FALSE(store.stageTree.contains({Level::StageMember, ID_TYPE("050000000000000000000001")}));
+
+  store.publish();
+  EXPECT_EQ(notifications.size(), 4);
+}
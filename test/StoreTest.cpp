@@ -0,0 +1,482 @@
+#include <gtest/gtest.h>
+
+#include <DigitalStage/Api/Store.h>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+using DigitalStage::Types::ID_TYPE;
+
+namespace {
+  nlohmann::json audioTrackPayload(const std::string& id, const std::string& stageMemberId = "050000000000000000000001", const std::string& stageDeviceId = "060000000000000000000001")
+  {
+    return {
+        {"_id", id},
+        {"userId", "010000000000000000000001"},
+        {"deviceId", "020000000000000000000001"},
+        {"stageId", "030000000000000000000001"},
+        {"stageMemberId", stageMemberId},
+        {"stageDeviceId", stageDeviceId},
+        {"type", "native"},
+        {"volume", 0.5},
+    };
+  }
+}
+
+TEST(StoreTest, TypedStorage) {
+  DigitalStage::Api::Store store;
+
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+  auto track = store.audioTracks.get(ID_TYPE("070000000000000000000001"));
+  ASSERT_TRUE(track);
+  EXPECT_EQ(track->stageMemberId, ID_TYPE("050000000000000000000001"));
+  EXPECT_DOUBLE_EQ(track->volume, 0.5);
+  EXPECT_FALSE(track->uuid);
+
+  // Invalid payloads are not stored
+  store.audioTracks.create({{"_id", "070000000000000000000002"}});
+  EXPECT_FALSE(store.audioTracks.get(ID_TYPE("070000000000000000000002")));
+  EXPECT_EQ(store.audioTracks.getAll().size(), 1);
+}
+
+TEST(StoreTest, ParsedEntitiesAreShared) {
+  DigitalStage::Api::Store store;
+
+  // Entities parsed by the caller are moved into the store and shared instead of copied
+  auto parsed = audioTrackPayload("070000000000000000000001").get<DigitalStage::Types::AudioTrack>();
+  const auto created = store.audioTracks.create(std::move(parsed));
+  ASSERT_TRUE(created);
+  EXPECT_EQ(store.audioTracks.getShared(ID_TYPE("070000000000000000000001")), created);
+
+  const auto updated = store.audioTracks.update({{"_id", "070000000000000000000001"}, {"volume", 0.25}});
+  ASSERT_TRUE(updated);
+  EXPECT_EQ(store.audioTracks.getShared(ID_TYPE("070000000000000000000001")), updated);
+  EXPECT_DOUBLE_EQ(updated->volume, 0.25);
+  EXPECT_DOUBLE_EQ(created->volume, 0.5);
+  EXPECT_FALSE(store.audioTracks.update({{"_id", "070000000000000000000001"}, {"stageMemberId", 1234}}));
+  EXPECT_FALSE(store.audioTracks.update({{"_id", "070000000000000000000002"}, {"volume", 0.1}}));
+
+  auto transaction = store.transaction();
+  const auto batched = transaction.audioTracks.create(audioTrackPayload("070000000000000000000002").get<DigitalStage::Types::AudioTrack>());
+  EXPECT_FALSE(store.audioTracks.getShared(ID_TYPE("070000000000000000000002")));
+  transaction.commit();
+  EXPECT_EQ(store.audioTracks.getShared(ID_TYPE("070000000000000000000002")), batched);
+}
+
+TEST(StoreTest, FieldLevelPatch) {
+  DigitalStage::Api::Store store;
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"volume", 0.25}, {"uuid", "channel-1"}});
+  auto track = store.audioTracks.get(ID_TYPE("070000000000000000000001"));
+  ASSERT_TRUE(track);
+  EXPECT_DOUBLE_EQ(track->volume, 0.25);
+  EXPECT_EQ(track->uuid, "channel-1");
+  EXPECT_EQ(track->stageMemberId, ID_TYPE("050000000000000000000001"));
+
+  // null resets optional values
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"uuid", nullptr}});
+  EXPECT_FALSE(store.audioTracks.get(ID_TYPE("070000000000000000000001"))->uuid);
+
+  // Invalid patches are not applied at all
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"type", "browser"}, {"stageMemberId", 1234}});
+  track = store.audioTracks.get(ID_TYPE("070000000000000000000001"));
+  EXPECT_EQ(track->type, "native");
+  EXPECT_EQ(track->stageMemberId, ID_TYPE("050000000000000000000001"));
+
+  // Unknown entities are not created by patches
+  store.audioTracks.update({{"_id", "070000000000000000000002"}, {"volume", 1.0}});
+  EXPECT_FALSE(store.audioTracks.get(ID_TYPE("070000000000000000000002")));
+
+  // Missing or malformed ids are rejected without throwing
+  EXPECT_FALSE(store.audioTracks.update({{"volume", 1.0}}));
+  EXPECT_FALSE(store.audioTracks.update({{"_id", "not-an-id"}, {"volume", 1.0}}));
+  EXPECT_FALSE(store.audioTracks.update({{"_id", 7}, {"volume", 1.0}}));
+  EXPECT_FALSE(store.audioTracks.update("not an object"));
+}
+
+TEST(StoreTest, RelationshipIndexes) {
+  DigitalStage::Api::Store store;
+  store.stageMembers.create({{"_id", "050000000000000000000001"}, {"stageId", "030000000000000000000001"}, {"userId", "010000000000000000000001"}, {"groupId", "040000000000000000000001"}, {"active", true}, {"isDirector", false}});
+  store.stageMembers.create({{"_id", "050000000000000000000002"}, {"stageId", "030000000000000000000001"}, {"userId", "010000000000000000000002"}, {"groupId", "040000000000000000000002"}, {"active", true}, {"isDirector", false}});
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001", "050000000000000000000001", "060000000000000000000001"));
+  store.audioTracks.create(audioTrackPayload("070000000000000000000002", "050000000000000000000001", "060000000000000000000002"));
+  store.audioTracks.create(audioTrackPayload("070000000000000000000003", "050000000000000000000002", "060000000000000000000003"));
+
+  EXPECT_EQ(store.getAudioTracksByStageMember(ID_TYPE("050000000000000000000001")).size(), 2);
+  EXPECT_EQ(store.getAudioTracksByStageDevice(ID_TYPE("060000000000000000000003")).size(), 1);
+  EXPECT_EQ(store.getStageMembersByGroup(ID_TYPE("040000000000000000000001")).size(), 1);
+  EXPECT_EQ(store.getAudioTracksByGroup(ID_TYPE("040000000000000000000001")).size(), 2);
+
+  // Indexes follow patches of the foreign keys
+  store.audioTracks.update({{"_id", "070000000000000000000002"}, {"stageMemberId", "050000000000000000000002"}});
+  EXPECT_EQ(store.getAudioTracksByStageMember(ID_TYPE("050000000000000000000001")).size(), 1);
+  EXPECT_EQ(store.getAudioTracksByStageMember(ID_TYPE("050000000000000000000002")).size(), 2);
+  store.stageMembers.update({{"_id", "050000000000000000000002"}, {"groupId", "040000000000000000000001"}});
+  EXPECT_EQ(store.getAudioTracksByGroup(ID_TYPE("040000000000000000000001")).size(), 3);
+  EXPECT_TRUE(store.getStageMembersByGroup(ID_TYPE("040000000000000000000002")).empty());
+  store.stageMembers.update({{"_id", "050000000000000000000002"}, {"groupId", nullptr}});
+  EXPECT_EQ(store.getStageMembersByGroup(ID_TYPE("040000000000000000000001")).size(), 1);
+
+  // and removals
+  store.audioTracks.remove(ID_TYPE("070000000000000000000001"));
+  EXPECT_TRUE(store.getAudioTracksByStageMember(ID_TYPE("050000000000000000000001")).empty());
+  store.audioTracks.removeAll();
+  EXPECT_TRUE(store.getAudioTracksByStageDevice(ID_TYPE("060000000000000000000003")).empty());
+}
+
+TEST(StoreTest, Snapshots) {
+  DigitalStage::Api::Store store;
+  auto empty = store.snapshot();
+  ASSERT_TRUE(empty);
+  EXPECT_TRUE(empty->audioTracks->empty());
+
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+  store.setStageId(ID_TYPE("030000000000000000000001"));
+  // Changes are invisible to readers until published
+  EXPECT_TRUE(store.snapshot()->audioTracks->empty());
+  EXPECT_FALSE(store.snapshot()->stageId);
+
+  store.publish();
+  auto first = store.snapshot();
+  ASSERT_EQ(first->audioTracks->size(), 1);
+  EXPECT_EQ(first->stageId, ID_TYPE("030000000000000000000001"));
+
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"volume", 0.75}});
+  store.publish();
+  auto second = store.snapshot();
+  // Older snapshots stay unchanged, untouched collections are shared
+  EXPECT_DOUBLE_EQ(first->audioTracks->at(ID_TYPE("070000000000000000000001"))->volume, 0.5);
+  EXPECT_DOUBLE_EQ(second->audioTracks->at(ID_TYPE("070000000000000000000001"))->volume, 0.75);
+  EXPECT_EQ(first->stageMembers, second->stageMembers);
+  EXPECT_TRUE(empty->audioTracks->empty());
+}
+
+TEST(StoreTest, Visitors) {
+  DigitalStage::Api::Store store;
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001", "050000000000000000000001"));
+  store.audioTracks.create(audioTrackPayload("070000000000000000000002", "050000000000000000000001"));
+  store.audioTracks.create(audioTrackPayload("070000000000000000000003", "050000000000000000000002"));
+
+  std::size_t visited = 0;
+  store.audioTracks.forEach([&visited](const DigitalStage::Types::AudioTrack&) { ++visited; });
+  EXPECT_EQ(visited, 3);
+
+  std::vector<DigitalStage::Types::ID_TYPE> ids;
+  store.audioTracks.forEachBy("stageMemberId", DigitalStage::Types::ID_TYPE("050000000000000000000001"), [&ids](const DigitalStage::Types::AudioTrack& track) { ids.push_back(track._id); });
+  EXPECT_EQ(ids, std::vector<DigitalStage::Types::ID_TYPE>({ID_TYPE("070000000000000000000001"), ID_TYPE("070000000000000000000002")}));
+
+  EXPECT_EQ(store.audioTracks.count([](const auto& track) { return track.stageMemberId == ID_TYPE("050000000000000000000002"); }), 1);
+  auto found = store.audioTracks.find([](const auto& track) { return track.stageMemberId == ID_TYPE("050000000000000000000002"); });
+  ASSERT_TRUE(found);
+  EXPECT_EQ(found->_id, ID_TYPE("070000000000000000000003"));
+  EXPECT_FALSE(store.audioTracks.find([](const auto& track) { return track.stageMemberId == ID_TYPE("050000000000000000000003"); }));
+  EXPECT_EQ(store.audioTracks.size(), 3);
+}
+
+TEST(StoreTest, Transactions) {
+  DigitalStage::Api::Store store;
+  std::vector<DigitalStage::Api::Store::ChangeSet> notifications;
+  store.changed.connect([&notifications](const DigitalStage::Api::Store::ChangeSet& changes) { notifications.push_back(changes); });
+
+  auto transaction = store.transaction();
+  transaction.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+  transaction.audioTracks.create(audioTrackPayload("070000000000000000000002"));
+  transaction.audioTracks.update({{"_id", "070000000000000000000001"}, {"volume", 0.1}});
+  // Patches with invalid ids are skipped instead of aborting the rest of the transaction
+  transaction.audioTracks.update({{"_id", "not-an-id"}, {"volume", 0.3}});
+  transaction.audioTracks.update({{"volume", 0.3}});
+  transaction.stageMembers.create({{"_id", "050000000000000000000001"}, {"stageId", "030000000000000000000001"}, {"userId", "010000000000000000000001"}, {"active", true}, {"isDirector", false}});
+  // Nothing is applied before commit
+  EXPECT_EQ(store.audioTracks.size(), 0);
+  transaction.commit();
+
+  EXPECT_EQ(store.audioTracks.size(), 2);
+  EXPECT_DOUBLE_EQ(store.audioTracks.get(ID_TYPE("070000000000000000000001"))->volume, 0.1);
+  EXPECT_EQ(store.snapshot()->audioTracks->size(), 2);
+  ASSERT_EQ(notifications.size(), 1);
+  EXPECT_EQ(notifications[0].audioTracks.added, std::set<DigitalStage::Types::ID_TYPE>({ID_TYPE("070000000000000000000001"), ID_TYPE("070000000000000000000002")}));
+  EXPECT_TRUE(notifications[0].audioTracks.changed.empty());
+  EXPECT_EQ(notifications[0].stageMembers.added.size(), 1);
+
+  // Publishing without changes does not notify
+  store.publish();
+  EXPECT_EQ(notifications.size(), 1);
+
+  store.audioTracks.update({{"_id", "070000000000000000000002"}, {"volume", 0.2}});
+  store.audioTracks.remove(ID_TYPE("070000000000000000000001"));
+  store.publish();
+  ASSERT_EQ(notifications.size(), 2);
+  EXPECT_EQ(notifications[1].audioTracks.changed, std::set<DigitalStage::Types::ID_TYPE>({ID_TYPE("070000000000000000000002")}));
+  EXPECT_EQ(notifications[1].audioTracks.removed, std::set<DigitalStage::Types::ID_TYPE>({ID_TYPE("070000000000000000000001")}));
+}
+
+TEST(StoreTest, SoundCardByCompositeKey) {
+  DigitalStage::Api::Store store;
+  auto soundCard = [](const std::string& id, const std::string& label) -> nlohmann::json {
+    return {{"_id", id}, {"uuid", label}, {"deviceId", "020000000000000000000001"}, {"audioEngine", "juce"}, {"audioDriver", "CoreAudio"},
+            {"type", "input"}, {"label", label}, {"sampleRate", 48000}, {"sampleRates", {44100, 48000}}, {"bufferSize", 256},
+            {"periodSize", 256}, {"numPeriods", 2}, {"channels", nlohmann::json::array()}, {"online", true}, {"userId", "010000000000000000000001"}};
+  };
+  store.soundCards.create(soundCard("090000000000000000000001", "Built-in"));
+  store.soundCards.create(soundCard("090000000000000000000002", "External"));
+
+  auto found = store.getSoundCardByDeviceAndDriverAndTypeAndLabel(ID_TYPE("020000000000000000000001"), "CoreAudio", "input", "External");
+  ASSERT_TRUE(found);
+  EXPECT_EQ(found->_id, ID_TYPE("090000000000000000000002"));
+  EXPECT_FALSE(store.getSoundCardByDeviceAndDriverAndTypeAndLabel(ID_TYPE("020000000000000000000001"), "CoreAudio", "output", "External"));
+
+  // Patches of the key fields move the entry inside the index
+  store.soundCards.update({{"_id", "090000000000000000000002"}, {"type", "output"}, {"label", "USB"}});
+  EXPECT_FALSE(store.getSoundCardByDeviceAndDriverAndTypeAndLabel(ID_TYPE("020000000000000000000001"), "CoreAudio", "input", "External"));
+  found = store.getSoundCardByDeviceAndDriverAndTypeAndLabel(ID_TYPE("020000000000000000000001"), "CoreAudio", "output", "USB");
+  ASSERT_TRUE(found);
+  EXPECT_EQ(found->_id, ID_TYPE("090000000000000000000002"));
+
+  store.soundCards.remove(ID_TYPE("090000000000000000000002"));
+  EXPECT_FALSE(store.getSoundCardByDeviceAndDriverAndTypeAndLabel(ID_TYPE("020000000000000000000001"), "CoreAudio", "output", "USB"));
+  EXPECT_TRUE(store.getSoundCardByDeviceAndDriverAndTypeAndLabel(ID_TYPE("020000000000000000000001"), "CoreAudio", "input", "Built-in"));
+}
+
+TEST(StoreTest, UniqueIndexes) {
+  DigitalStage::Api::Store store;
+  auto track = audioTrackPayload("070000000000000000000001");
+  track["uuid"] = "channel1";
+  store.audioTracks.create(track);
+  store.audioTracks.create(audioTrackPayload("070000000000000000000002"));
+
+  auto found = store.getAudioTrackByUuid("channel1");
+  ASSERT_TRUE(found);
+  EXPECT_EQ(found->_id, ID_TYPE("070000000000000000000001"));
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"uuid", "channel2"}});
+  EXPECT_FALSE(store.getAudioTrackByUuid("channel1"));
+  EXPECT_TRUE(store.getAudioTrackByUuid("channel2"));
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"uuid", nullptr}});
+  EXPECT_FALSE(store.getAudioTrackByUuid("channel2"));
+
+  store.customGroups.create({{"_id", "080000000000000000000001"}, {"groupId", "040000000000000000000001"}, {"targetGroupId", "040000000000000000000002"}, {"stageId", "030000000000000000000001"}, {"volume", 0.5}});
+  auto customGroup = store.getCustomGroupByGroupAndTargetGroup(ID_TYPE("040000000000000000000001"), ID_TYPE("040000000000000000000002"));
+  ASSERT_TRUE(customGroup);
+  EXPECT_EQ(customGroup->_id, ID_TYPE("080000000000000000000001"));
+  EXPECT_FALSE(store.getCustomGroupByGroupAndTargetGroup(ID_TYPE("040000000000000000000002"), ID_TYPE("040000000000000000000001")));
+  store.customGroups.update({{"_id", "080000000000000000000001"}, {"targetGroupId", "040000000000000000000003"}});
+  EXPECT_FALSE(store.getCustomGroupByGroupAndTargetGroup(ID_TYPE("040000000000000000000001"), ID_TYPE("040000000000000000000002")));
+  EXPECT_TRUE(store.getCustomGroupByGroupAndTargetGroup(ID_TYPE("040000000000000000000001"), ID_TYPE("040000000000000000000003")));
+  store.customGroups.remove(ID_TYPE("080000000000000000000001"));
+  EXPECT_FALSE(store.getCustomGroupByGroupAndTargetGroup(ID_TYPE("040000000000000000000001"), ID_TYPE("040000000000000000000003")));
+}
+
+TEST(StoreTest, Cache) {
+  const auto path = (std::filesystem::temp_directory_path() / "libds-store-test.cache").string();
+  {
+    DigitalStage::Api::Store store;
+    store.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+    store.audioTracks.create(audioTrackPayload("070000000000000000000002"));
+    store.customGroups.create({{"_id", "080000000000000000000001"}, {"groupId", "040000000000000000000001"}, {"targetGroupId", "040000000000000000000002"}, {"stageId", "030000000000000000000001"}, {"volume", 0.5}});
+    store.setStageId(ID_TYPE("030000000000000000000001"));
+    store.setStageMemberId(ID_TYPE("050000000000000000000001"));
+    ASSERT_TRUE(store.save(path));
+  }
+
+  DigitalStage::Api::Store store;
+  ASSERT_TRUE(store.load(path));
+  EXPECT_EQ(store.snapshot()->audioTracks->size(), 2);
+  EXPECT_EQ(store.audioTracks.get(ID_TYPE("070000000000000000000002"))->volume, 0.5);
+  EXPECT_TRUE(store.getCustomGroupByGroupAndTargetGroup(ID_TYPE("040000000000000000000001"), ID_TYPE("040000000000000000000002")));
+  EXPECT_EQ(store.getStageId(), ID_TYPE("030000000000000000000001"));
+  EXPECT_EQ(store.getStageMemberId(), ID_TYPE("050000000000000000000001"));
+
+  // The resync confirms track1 only and does not join the stage again
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+  store.purgeUnconfirmed();
+  EXPECT_TRUE(store.audioTracks.get(ID_TYPE("070000000000000000000001")));
+  EXPECT_FALSE(store.audioTracks.get(ID_TYPE("070000000000000000000002")));
+  EXPECT_EQ(store.customGroups.size(), 0);
+  EXPECT_FALSE(store.getStageId());
+  EXPECT_FALSE(store.getStageMemberId());
+
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << "garbage";
+  EXPECT_FALSE(store.load(path));
+
+  // A malformed id fails the whole load instead of leaving the store half restored
+  nlohmann::json state;
+  for (const auto* collection : {"users", "devices", "soundCards", "stages", "groups", "customGroups", "stageMembers", "stageDevices", "audioTracks", "videoTracks"}) {
+    state[collection] = nlohmann::json::array();
+  }
+  state["audioTracks"].push_back(audioTrackPayload("070000000000000000000003"));
+  const auto cbor = nlohmann::json::to_cbor({{"version", 1}, {"state", state}, {"userId", "010000000000000000000001"}, {"stageId", "corrupted"}});
+  std::ofstream(path, std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char*>(cbor.data()), static_cast<std::streamsize>(cbor.size()));
+  EXPECT_FALSE(store.load(path));
+  EXPECT_FALSE(store.audioTracks.get(ID_TYPE("070000000000000000000003")));
+  EXPECT_FALSE(store.getUserId());
+  EXPECT_FALSE(store.getStageId());
+  std::filesystem::remove(path);
+  EXPECT_FALSE(store.load(path));
+}
+
+TEST(StoreTest, Versions) {
+  DigitalStage::Api::Store store;
+  EXPECT_EQ(store.audioTracks.version(), 0);
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+  store.audioTracks.create(audioTrackPayload("070000000000000000000002"));
+  store.audioTracks.create(audioTrackPayload("070000000000000000000003"));
+  const auto version = store.audioTracks.version();
+  EXPECT_EQ(version, 3);
+  EXPECT_EQ(store.audioTracks.versionOf(ID_TYPE("070000000000000000000002")), 2);
+  EXPECT_TRUE(store.audioTracks.changedSince(version).empty());
+
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"volume", 1.0}});
+  store.audioTracks.remove(ID_TYPE("070000000000000000000003"));
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"volume", 0.8}});
+  EXPECT_EQ(store.audioTracks.changedSince(version), (std::vector<DigitalStage::Types::ID_TYPE>{ID_TYPE("070000000000000000000003"), ID_TYPE("070000000000000000000001")}));
+  EXPECT_EQ(store.audioTracks.changedSince(0), (std::vector<DigitalStage::Types::ID_TYPE>{ID_TYPE("070000000000000000000002"), ID_TYPE("070000000000000000000003"), ID_TYPE("070000000000000000000001")}));
+  EXPECT_EQ(store.audioTracks.versionOf(ID_TYPE("070000000000000000000001")), 6);
+  EXPECT_EQ(store.audioTracks.versionOf(ID_TYPE("ff0000000000000000000000")), 0);
+}
+
+TEST(StoreTest, MemoryUsage) {
+  DigitalStage::Api::Store store;
+  const auto empty = store.memoryUsage();
+  EXPECT_EQ(empty.entities, 0);
+
+  for (int i = 0; i < 100; ++i) {
+    store.audioTracks.create(audioTrackPayload(fmt::format("07{:022x}", i)));
+  }
+  auto usage = store.memoryUsage();
+  EXPECT_EQ(usage.audioTracks.entities, 100);
+  EXPECT_EQ(usage.entities, 100);
+  EXPECT_GT(usage.audioTracks.bytes, 100 * sizeof(DigitalStage::Types::AudioTrack));
+  EXPECT_EQ(usage.peakBytes, usage.bytes);
+
+  store.audioTracks.removeAll();
+  usage = store.memoryUsage();
+  EXPECT_EQ(usage.audioTracks.entities, 0);
+  EXPECT_EQ(usage.audioTracks.peakEntities, 100);
+  EXPECT_GT(usage.peakBytes, usage.bytes);
+
+  int reports = 0;
+  store.memoryUsageReported.connect([&](const DigitalStage::Api::Store::MemoryUsage&) { ++reports; });
+  store.publish();
+  EXPECT_EQ(reports, 0);
+  store.setMemoryUsageReportInterval(std::chrono::milliseconds(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  store.publish();
+  store.publish();
+  EXPECT_EQ(reports, 1);
+}
+
+TEST(StoreTest, RemoveAll) {
+  DigitalStage::Api::Store store;
+  std::vector<DigitalStage::Api::Store::ChangeSet> notifications;
+  store.changed.connect([&](const DigitalStage::Api::Store::ChangeSet& changes) { notifications.push_back(changes); });
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+  store.audioTracks.create(audioTrackPayload("070000000000000000000002"));
+  store.publish();
+  const auto before = store.snapshot();
+  const auto version = store.audioTracks.version();
+
+  store.audioTracks.removeAll();
+  store.audioTracks.create(audioTrackPayload("070000000000000000000003"));
+  EXPECT_EQ(store.audioTracks.size(), 1);
+  EXPECT_EQ(store.getAudioTracksByStageMember(ID_TYPE("050000000000000000000001")).size(), 1);
+  EXPECT_TRUE(store.audioTracks.clearedSince(version));
+  EXPECT_EQ(store.audioTracks.changedSince(version), (std::vector<DigitalStage::Types::ID_TYPE>{ID_TYPE("070000000000000000000003")}));
+
+  store.publish();
+  ASSERT_EQ(notifications.size(), 2);
+  EXPECT_TRUE(notifications[1].audioTracks.cleared);
+  EXPECT_TRUE(notifications[1].audioTracks.removed.empty());
+  EXPECT_EQ(notifications[1].audioTracks.added, std::set<DigitalStage::Types::ID_TYPE>({ID_TYPE("070000000000000000000003")}));
+  EXPECT_FALSE(store.audioTracks.clearedSince(store.audioTracks.version()));
+
+  // Readers of the previous snapshot are not affected
+  EXPECT_EQ(before->audioTracks->size(), 2);
+  EXPECT_EQ(store.snapshot()->audioTracks->size(), 1);
+}
+
+TEST(StoreTest, ConcurrentPublishes) {
+  DigitalStage::Api::Store store;
+  for (int i = 0; i < 4; i++) {
+    store.audioTracks.create(audioTrackPayload("07000000000000000000000" + std::to_string(i)));
+  }
+  store.publish();
+
+  // Each change is reported exactly once, and notifications of different publishers never overlap
+  std::atomic<int> notifying {0};
+  std::atomic<bool> overlapped {false};
+  std::atomic<std::size_t> reported {0};
+  store.changed.connect([&notifying, &overlapped, &reported](const DigitalStage::Api::Store::ChangeSet& changes) {
+    if (notifying.fetch_add(1) > 0) {
+      overlapped = true;
+    }
+    reported += changes.audioTracks.changed.size();
+    std::this_thread::yield();
+    notifying--;
+  });
+  std::vector<std::thread> publishers;
+  for (int i = 0; i < 4; i++) {
+    publishers.emplace_back([&store, i] {
+      const auto id = "07000000000000000000000" + std::to_string(i);
+      for (int round = 0; round < 200; round++) {
+        store.audioTracks.update({{"_id", id}, {"volume", round / 200.0}});
+        store.publish();
+      }
+    });
+  }
+  for (auto& publisher : publishers) {
+    publisher.join();
+  }
+  EXPECT_FALSE(overlapped);
+  // Updates of the same track before a publish are coalesced
+  EXPECT_LE(reported, 800);
+  EXPECT_GE(reported, 4);
+}
+
+TEST(StoreTest, StageArena) {
+  DigitalStage::Api::Store store;
+  store.beginStageArena();
+  std::weak_ptr<DigitalStage::Api::StageArena> arena = store.audioTracks.getArena();
+  ASSERT_FALSE(arena.expired());
+  EXPECT_EQ(store.stageMembers.getArena(), arena.lock());
+  EXPECT_FALSE(store.stages.getArena());
+
+  store.audioTracks.create(audioTrackPayload("070000000000000000000001"));
+  store.audioTracks.update({{"_id", "070000000000000000000001"}, {"volume", 1.0}});
+  auto track = store.audioTracks.getShared(ID_TYPE("070000000000000000000001"));
+  EXPECT_EQ(track->volume, 1.0);
+
+  // Every stage scoped collection allocates from the arena
+  store.stageMembers.create({{"_id", "050000000000000000000001"}, {"stageId", "030000000000000000000001"}, {"userId", "010000000000000000000001"},
+                             {"groupId", nullptr}, {"active", true}, {"isDirector", false}});
+  store.stageDevices.create({{"_id", "060000000000000000000001"}, {"userId", "010000000000000000000001"}, {"deviceId", "020000000000000000000001"},
+                             {"stageId", "030000000000000000000001"}, {"stageMemberId", "050000000000000000000001"}, {"active", true},
+                             {"type", "native"}, {"order", 0}, {"sendLocal", true}});
+  store.videoTracks.create({{"_id", "0a0000000000000000000001"}, {"userId", "010000000000000000000001"}, {"deviceId", "020000000000000000000001"},
+                            {"stageId", "030000000000000000000001"}, {"stageMemberId", "050000000000000000000001"},
+                            {"stageDeviceId", "060000000000000000000001"}, {"type", "browser"}});
+  store.customGroups.create({{"_id", "080000000000000000000001"}, {"groupId", "040000000000000000000001"},
+                             {"targetGroupId", "040000000000000000000002"}, {"stageId", "030000000000000000000001"}});
+  for (const auto& other : {store.stageMembers.getArena(), store.stageDevices.getArena(), store.videoTracks.getArena(), store.customGroups.getArena()}) {
+    EXPECT_EQ(other, arena.lock());
+  }
+  ASSERT_TRUE(store.stageDevices.get(ID_TYPE("060000000000000000000001")));
+  ASSERT_TRUE(store.videoTracks.get(ID_TYPE("0a0000000000000000000001")));
+  ASSERT_TRUE(store.customGroups.get(ID_TYPE("080000000000000000000001")));
+
+  // The arena lives as long as any of its entities
+  store.stageMembers.removeAll();
+  store.customGroups.removeAll();
+  store.videoTracks.removeAll();
+  store.audioTracks.removeAll();
+  store.endStageArena();
+  store.publish();
+  EXPECT_FALSE(arena.expired());
+  store.stageDevices.removeAll();
+  store.publish();
+  EXPECT_FALSE(arena.expired());
+  track.reset();
+  EXPECT_TRUE(arena.expired());
+
+  store.audioTracks.create(audioTrackPayload("070000000000000000000002"));
+  EXPECT_TRUE(store.audioTracks.get(ID_TYPE("070000000000000000000002")));
+}